@@ -22,6 +22,232 @@ class CborTypes(Enum):
     CBOR_TYPE_MAP = 13
 
 
+# C representation and decode statement for each argument type of a typed stub; None means the argument is only
+# type checked and gets no field in the generated args struct. Strings are passed as a pointer into the request
+# buffer plus a <name>_length field, without being copied. Integers outside the range of int64_t are refused instead
+# of wrapping around.
+TYPED_ARGUMENT_DECODERS = {
+    CborTypes.CBOR_TYPE_NULL: None,
+    CborTypes.CBOR_TYPE_BOOL: ("bool", "cbor_value_get_boolean(&it, &args.{name});"),
+    CborTypes.CBOR_TYPE_SIMPLE: ("uint8_t", "cbor_value_get_simple_type(&it, &args.{name});"),
+    CborTypes.CBOR_TYPE_SIGNED_INTEGER: ("int64_t", "if (cbor_value_get_int64_checked(&it, &args.{name}) != CborNoError) return RPC_ERROR_INVALID_ARGS;"),
+    CborTypes.CBOR_TYPE_UNSIGNED_INTEGER: ("uint64_t", "cbor_value_get_uint64(&it, &args.{name});"),
+    CborTypes.CBOR_TYPE_NEGATIVE_INTEGER: ("int64_t", "if (cbor_value_get_int64_checked(&it, &args.{name}) != CborNoError) return RPC_ERROR_INVALID_ARGS;"),
+    CborTypes.CBOR_TYPE_HALF_FLOAT: ("uint16_t", "cbor_value_get_half_float(&it, &args.{name});"),
+    CborTypes.CBOR_TYPE_FLOAT: ("float", "cbor_value_get_float(&it, &args.{name});"),
+    CborTypes.CBOR_TYPE_DOUBLE: ("double", "cbor_value_get_double(&it, &args.{name});"),
+    CborTypes.CBOR_TYPE_TEXT_STRING: ("const char *", "if (rpc_get_text_string_view(&it, &args.{name}, &args.{name}_length) != RPC_OK) return RPC_ERROR_INVALID_ARGS;"),
+    CborTypes.CBOR_TYPE_BYTE_STRING: ("const uint8_t *", "if (rpc_get_byte_string_view(&it, &args.{name}, &args.{name}_length) != RPC_OK) return RPC_ERROR_INVALID_ARGS;"),
+    CborTypes.CBOR_TYPE_ARRAY: ("CborValue", "args.{name} = it;"),
+    CborTypes.CBOR_TYPE_MAP: ("CborValue", "args.{name} = it;"),
+}
+
+
+# Parameters and encode statement for each argument type of a client request encoder. Strings are passed with their
+# length, arrays and maps as CBOR that was encoded beforehand and is copied into the request.
+CLIENT_ARGUMENT_ENCODERS = {
+    CborTypes.CBOR_TYPE_NULL: (None, "cbor_encode_null(&request.args);"),
+    CborTypes.CBOR_TYPE_BOOL: ("bool {name}", "cbor_encode_boolean(&request.args, {name});"),
+    CborTypes.CBOR_TYPE_SIMPLE: ("uint8_t {name}", "cbor_encode_simple_value(&request.args, {name});"),
+    CborTypes.CBOR_TYPE_SIGNED_INTEGER: ("int64_t {name}", "cbor_encode_int(&request.args, {name});"),
+    CborTypes.CBOR_TYPE_UNSIGNED_INTEGER: ("uint64_t {name}", "cbor_encode_uint(&request.args, {name});"),
+    CborTypes.CBOR_TYPE_NEGATIVE_INTEGER: ("int64_t {name}", "cbor_encode_int(&request.args, {name});"),
+    CborTypes.CBOR_TYPE_HALF_FLOAT: ("uint16_t {name}", "cbor_encode_half_float(&request.args, &{name});"),
+    CborTypes.CBOR_TYPE_FLOAT: ("float {name}", "cbor_encode_float(&request.args, {name});"),
+    CborTypes.CBOR_TYPE_DOUBLE: ("double {name}", "cbor_encode_double(&request.args, {name});"),
+    CborTypes.CBOR_TYPE_TEXT_STRING: ("const char *{name}, size_t {name}_length",
+                                      "cbor_encode_text_string(&request.args, {name}, {name}_length);"),
+    CborTypes.CBOR_TYPE_BYTE_STRING: ("const uint8_t *{name}, size_t {name}_length",
+                                      "cbor_encode_byte_string(&request.args, {name}, {name}_length);"),
+    CborTypes.CBOR_TYPE_ARRAY: ("const uint8_t *{name}, size_t {name}_length",
+                                "rpc_client_append_encoded(&request, {name}, {name}_length);"),
+    CborTypes.CBOR_TYPE_MAP: ("const uint8_t *{name}, size_t {name}_length",
+                              "rpc_client_append_encoded(&request, {name}, {name}_length);"),
+}
+
+
+# C representation, encode statement and worst case encoded size of each fixed size result type
+RESULT_ENCODERS = {
+    CborTypes.CBOR_TYPE_NULL: (None, "cbor_encode_null({encoder})", 1),
+    CborTypes.CBOR_TYPE_BOOL: ("bool", "cbor_encode_boolean({encoder}, {value})", 1),
+    CborTypes.CBOR_TYPE_SIMPLE: ("uint8_t", "cbor_encode_simple_value({encoder}, {value})", 2),
+    CborTypes.CBOR_TYPE_SIGNED_INTEGER: ("int64_t", "cbor_encode_int({encoder}, {value})", 9),
+    CborTypes.CBOR_TYPE_UNSIGNED_INTEGER: ("uint64_t", "cbor_encode_uint({encoder}, {value})", 9),
+    CborTypes.CBOR_TYPE_NEGATIVE_INTEGER: ("int64_t", "cbor_encode_int({encoder}, {value})", 9),
+    CborTypes.CBOR_TYPE_HALF_FLOAT: ("uint16_t", "cbor_encode_half_float({encoder}, &{value})", 3),
+    CborTypes.CBOR_TYPE_FLOAT: ("float", "cbor_encode_float({encoder}, {value})", 5),
+    CborTypes.CBOR_TYPE_DOUBLE: ("double", "cbor_encode_double({encoder}, {value})", 9),
+}
+
+# text keys of the protocol, their index is the key used in compact mode (rpc_key_t)
+COMPACT_KEYS = ["id", "func", "args", "res", "err", "c", "msg"]
+
+# {map header, "id": <uint64>, "res": }
+RESPONSE_HEADER_MAX_SIZE = 1 + 3 + 9 + 4
+
+
+def cbor_header_size(value):
+    if value < 24:
+        return 1
+    elif value <= 0xFF:
+        return 2
+    elif value <= 0xFFFF:
+        return 3
+    elif value <= 0xFFFFFFFF:
+        return 5
+    return 9
+
+
+def result_field(name, spec):
+    """
+    A result field is a fixed size CborTypes value, or a (CBOR_TYPE_TEXT_STRING, max_length) or
+    (CBOR_TYPE_BYTE_STRING, max_length) tuple
+    """
+    if isinstance(spec, tuple):
+        string_type, max_length = spec
+        if string_type == CborTypes.CBOR_TYPE_TEXT_STRING:
+            c_type, encode = "const char *", "cbor_encode_text_string({encoder}, {value}, {value}_length)"
+        elif string_type == CborTypes.CBOR_TYPE_BYTE_STRING:
+            c_type, encode = "const uint8_t *", "cbor_encode_byte_string({encoder}, {value}, {value}_length)"
+        else:
+            raise ValueError("only strings take a maximum length in a result schema")
+
+        return {"name": name, "c_type": c_type, "encode": encode, "max_length": max_length,
+                "max_size": cbor_header_size(max_length) + max_length}
+
+    if spec not in RESULT_ENCODERS:
+        raise ValueError("{} needs a maximum length to be used in a result schema".format(spec.name))
+
+    c_type, encode, max_size = RESULT_ENCODERS[spec]
+    return {"name": name, "c_type": c_type, "encode": encode, "max_length": None, "max_size": max_size}
+
+
+def result_schema(name, spec):
+    """
+    The result of a function is a single result field, or a list of fields that is encoded as a fixed length array.
+    Array elements may be given as (name, field) tuples, otherwise they are called value0, value1, ...
+    """
+    if isinstance(spec, list):
+        fields = []
+        for index, element in enumerate(spec):
+            if isinstance(element, tuple) and isinstance(element[0], str):
+                fields.append(result_field(*element))
+            else:
+                fields.append(result_field("value{}".format(index), element))
+
+        max_size = cbor_header_size(len(fields)) + sum(x["max_size"] for x in fields)
+        return {"name": name, "is_array": True, "fields": fields, "max_size": max_size}
+
+    field = result_field("value", spec)
+    return {"name": name, "is_array": False, "fields": [field], "max_size": field["max_size"]}
+
+
+def normalise_function(spec):
+    """
+    A function is either declared as a plain list of argument types, or as a dict with the argument list under "args"
+    and per-function options:
+
+        "typed": generate rpc_<name>_args_t and a stub that decodes the arguments before calling
+                 rpc_<name>_typed(const rpc_<name>_args_t *args, ...). Arguments may be given as (name, type) tuples
+                 to name the struct fields, otherwise they are called arg0, arg1, ...
+        "result": result schema (see result_schema). Generates rpc_<name>_result_t, rpc_<name>_encode_result and
+                  RPC_<NAME>_MAX_RESPONSE_SIZE, the largest response the function can produce including error
+                  responses. Typed functions with a result schema fill in the result struct instead of encoding.
+        "cacheable": the result only depends on the arguments. Results are kept in the table's response cache, keyed
+                     by the raw args array, and repeated calls are answered from it without calling the handler until
+                     rpc_cache_invalidate is called.
+        "lazy": only the number of arguments is checked before the call. The handler checks each argument with
+                rpc_check_argument_type as it reads it, typed stubs do so on their own. Meant for large array and map
+                arguments, which are then walked once by the handler instead of once more by the dispatcher.
+        "limits": {"depth": n, "items": n, "string_bytes": n}, any of them, overriding the limits given to
+                  generate_api. See rpc_limits_t; the arguments of functions with limits are never left to the handler,
+                  even when the function is lazy.
+    """
+    if not isinstance(spec, dict):
+        spec = {"args": spec}
+
+    arguments = []
+    for index, arg in enumerate(spec.get("args", [])):
+        if isinstance(arg, tuple):
+            arguments.append(arg)
+        else:
+            arguments.append(("arg{}".format(index), arg))
+
+    return {
+        "args": arguments,
+        "typed": spec.get("typed", False),
+        "result": spec.get("result"),
+        "lazy": spec.get("lazy", False),
+        "cacheable": spec.get("cacheable", False),
+        "limits": spec.get("limits", {}),
+    }
+
+
+def typed_function(name, function):
+    arguments = []
+    for arg_name, arg_type in function["args"]:
+        decoder = TYPED_ARGUMENT_DECODERS[arg_type]
+        if decoder is None:
+            arguments.append({"name": arg_name, "type": arg_type.name, "c_type": None, "decode": None})
+        else:
+            arguments.append({"name": arg_name, "type": arg_type.name, "c_type": decoder[0],
+                              "decode": decoder[1].format(name=arg_name),
+                              "has_length": arg_type in (CborTypes.CBOR_TYPE_TEXT_STRING,
+                                                         CborTypes.CBOR_TYPE_BYTE_STRING)})
+
+    return {"name": name, "arguments": arguments, "has_fields": any(x["c_type"] for x in arguments),
+            "has_result": function["result"] is not None, "lazy": function["lazy"]}
+
+
+def cbor_head(major_type, value):
+    size = cbor_header_size(value)
+    if size == 1:
+        return bytes([(major_type << 5) | value])
+
+    additional = {2: 24, 3: 25, 5: 26, 9: 27}[size]
+    return bytes([(major_type << 5) | additional]) + value.to_bytes(size - 1, "big")
+
+
+def cbor_text(text):
+    encoded = text.encode("ascii")
+    return cbor_head(3, len(encoded)) + encoded
+
+
+def builtin_results(rpc_funcs, rpc_table):
+    """
+    The results of __funcs, {name: index}, and __schema, {name: [argument type, ...]} with the rpc_argument_type_t
+    values, for every function that is not hidden. Both only depend on the table, so they are encoded here once.
+    """
+    visible = [(index, key) for index, key in enumerate(rpc_funcs) if not key.startswith('_')]
+
+    funcs = cbor_head(5, len(visible))
+    schema = cbor_head(5, len(visible))
+    for index, key in visible:
+        args = normalise_function(rpc_table[key])["args"]
+
+        funcs += cbor_text(key) + cbor_head(0, index)
+        # rpc_argument_type_t has no CBOR_TYPE_UNDEFINED and starts at CBOR_TYPE_NULL
+        schema += cbor_text(key) + cbor_head(4, len(args)) + b"".join(
+            cbor_head(0, x.value - CborTypes.CBOR_TYPE_NULL.value) for _, x in args)
+
+    return funcs, schema
+
+
+def format_bytes(data, per_line=16):
+    lines = [", ".join("0x{:02X}".format(x) for x in data[i:i + per_line]) for i in range(0, len(data), per_line)]
+    return ",\n        ".join(lines)
+
+
+class LengthSaltHash(IntSaltHash):
+    """
+    IntSaltHash with the key length mixed in, as computed by rpc_lookup_index_by_name. Keys that only differ in
+    length (a prefix and the full name) land on different vertices.
+    """
+
+    def __call__(self, key):
+        return (super().__call__(key) + len(key)) % self.N
+
+
 def split_hex(num: int):
     output = []
     while num:
@@ -31,7 +257,70 @@ def split_hex(num: int):
     return output
 
 
-def generate_api(path, rpc_table_in):
+def max_response_size(sizes):
+    """
+    The largest of the response sizes as a C expression, None if any of them is unknown. Sizes that are expressions
+    themselves are compared by the preprocessor.
+    """
+    sizes = list(sizes)
+    if None in sizes:
+        return None
+
+    largest = max(x for x in sizes if not isinstance(x, str))
+    for size in sizes:
+        if isinstance(size, str):
+            largest = "({0} > {1} ? {0} : {1})".format(largest, size)
+
+    return largest
+
+
+LIMIT_KEYS = ["depth", "items", "string_bytes"]
+
+
+def function_limits(name, table_limits, limits):
+    """
+    The limits of one function as (depth, items, string_bytes), None for unlimited, or None if it has none at all
+    """
+    for key in list(table_limits.keys()) + list(limits.keys()):
+        if key not in LIMIT_KEYS:
+            raise ValueError("unknown limit {} of {}".format(key, name))
+
+    merged = dict(table_limits, **limits)
+    if not merged:
+        return None
+
+    return tuple(merged.get(key) for key in LIMIT_KEYS)
+
+
+def loosest_limits(limits):
+    """
+    The limits of the dispatcher, which bound the walk over args that come before func: every limit is the largest of
+    any function's, so that no function's request is cut short. None as soon as one function has no limits, the args
+    of its requests must not be bounded by the walk either.
+    """
+    if any(x is None for x in limits):
+        return None
+
+    return tuple(None if any(x is None or x[i] is None for x in limits) else max(x[i] for x in limits)
+                 for i in range(len(LIMIT_KEYS)))
+
+
+# built-in functions implemented once in default_functions.c and shared by every table
+SHARED_BUILTINS = ["__ping", "__version", "__compact"]
+
+# the functions of rpc_client.h, a table function must not generate a client encoder of the same name
+CLIENT_API = ["rpc_client_request_init", "rpc_client_append_encoded", "rpc_client_request_finish",
+              "rpc_client_decode_response"]
+
+
+def generate_api(path, rpc_table_in, prefix="rpc", cache_slots=16, cache_slot_size=128, limits=None):
+    """
+    Generates <prefix>_api.c and <prefix>_api.h for one function table. Every symbol of the table is named after the
+    prefix: the handlers are <prefix>_<name> and the table is served through <prefix>_dispatcher, so several tables
+    can be linked into the same binary. Tables with cacheable functions get a response cache of cache_slots slots of
+    cache_slot_size bytes, which have to hold the args array and the result of a call. limits applies to every
+    function of the table, in the same form as the "limits" option of a function.
+    """
     current_path = os.path.dirname(os.path.realpath(__file__))
 
     rpc_table = rpc_table_in
@@ -39,16 +328,39 @@ def generate_api(path, rpc_table_in):
     rpc_funcs = list(rpc_table.keys())
 
     rpc_funcs.insert(0, "__version")
-    rpc_table["__version"] = []
+    rpc_table["__version"] = {"args": [], "max_result_size": RESULT_ENCODERS[CborTypes.CBOR_TYPE_UNSIGNED_INTEGER][2]}
 
     rpc_funcs.insert(0, "__ping")
-    rpc_table["__ping"] = []
+    rpc_table["__ping"] = {"args": [], "max_result_size": cbor_header_size(4) + 4}
 
     rpc_funcs.insert(0, "__funcs")
-    rpc_table["__funcs"] = []
+    rpc_table["__funcs"] = {"args": []}
+
+    # built-ins added later go to the end of the table, so existing function indices stay the same
+    rpc_funcs.append("__compact")
+    rpc_table["__compact"] = {"args": [], "max_result_size": 1 + sum(1 + len(x) + 1 for x in COMPACT_KEYS)}
+
+    rpc_funcs.append("__stats")
+    rpc_table["__stats"] = {"args": []}
+
+    rpc_funcs.append("__schema")
+    rpc_table["__schema"] = {"args": []}
 
     print(rpc_funcs)
-    f1, f2, G = generate_hash(rpc_funcs, Hash=IntSaltHash)
+    for key in rpc_funcs:
+        if not key.isascii() or len(key) > 255:
+            raise ValueError("function names have to be ASCII and at most 255 characters long: {}".format(key))
+        if "{}_client_{}".format(prefix, key) in CLIENT_API:
+            raise ValueError("the client encoder of {} would clash with {}_client_{} of rpc_client.h, rename the "
+                             "function or use another prefix".format(key, prefix, key))
+
+    f1, f2, G = generate_hash(rpc_funcs, Hash=LengthSaltHash)
+
+    # rpc_lookup_index_by_name sums the salted characters in an uint32_t and takes the modulo at the end, salts and
+    # graph values are stored as uint16_t
+    max_key_length = max(len(x) for x in rpc_funcs)
+    if len(G) > 0x10000 or max_key_length + max_key_length * 255 * (len(G) - 1) > 0xFFFFFFFF:
+        raise ValueError("function table too large for the 32 bit hash")
 
     env = jinja2.Environment(loader=jinja2.FileSystemLoader(current_path), trim_blocks=True, block_start_string='@@',
                              block_end_string='@@', variable_start_string='@=', variable_end_string='=@')
@@ -56,24 +368,86 @@ def generate_api(path, rpc_table_in):
     c_template = env.get_template("rpc_api.c.jinja2")
     h_template = env.get_template("rpc_api.h.jinja2")
 
+    funcs_result, schema_result = builtin_results(rpc_funcs, rpc_table)
+    rpc_table["__funcs"]["max_result_size"] = len(funcs_result)
+    rpc_table["__schema"]["max_result_size"] = len(schema_result)
+
+    # the size of __stats depends on SIMPLECBORRPC_STATS_BUCKETS, so it is left to the C preprocessor
+    rpc_table["__stats"]["max_result_size"] = "RPC_STATS_MAX_RESULT_SIZE({}, {})".format(
+        len(rpc_funcs), sum(cbor_header_size(len(x)) + len(x) for x in rpc_funcs))
+
+    # every distinct set of limits is emitted once, functions refer to it by index
+    limit_sets = []
+
+    def limits_index(function_limit):
+        if function_limit is None:
+            return None
+        if function_limit not in limit_sets:
+            limit_sets.append(function_limit)
+        return limit_sets.index(function_limit)
+
     rpc_functions = []
+    all_limits = []
+    typed_functions = []
+    result_schemas = []
+    response_sizes = []
     for index, key in enumerate(rpc_funcs):
-        val = rpc_table[key]
-        tmp = [key, ', '.join(x.name for x in val)]
-        rpc_functions.append(tmp)
+        function = normalise_function(rpc_table[key])
+        all_limits.append(function_limits(key, limits or {}, function["limits"]))
+        rpc_functions.append({
+            "name": key,
+            "symbol": "rpc_" + key if key in SHARED_BUILTINS else prefix + "_" + key,
+            "args": ', '.join(arg_type.name for _, arg_type in function["args"]),
+            "lazy": function["lazy"],
+            "cacheable": function["cacheable"],
+            "limits": limits_index(all_limits[-1]),
+            "index": index,
+            "argument_count": len(function["args"]),
+            "client_parameters": ''.join(", " + CLIENT_ARGUMENT_ENCODERS[arg_type][0].format(name=arg_name)
+                                         for arg_name, arg_type in function["args"]
+                                         if CLIENT_ARGUMENT_ENCODERS[arg_type][0] is not None),
+            "client_encodes": [CLIENT_ARGUMENT_ENCODERS[arg_type][1].format(name=arg_name)
+                               for arg_name, arg_type in function["args"]]
+        })
+
+        if function["typed"]:
+            typed_functions.append(typed_function(key, function))
+
+        max_result_size = rpc_table[key].get("max_result_size") if isinstance(rpc_table[key], dict) else None
+        if function["result"] is not None:
+            schema = result_schema(key, function["result"])
+            result_schemas.append(schema)
+            max_result_size = schema["max_size"]
+
+        if isinstance(max_result_size, str):
+            response_sizes.append([key.upper(), "({} + {})".format(RESPONSE_HEADER_MAX_SIZE, max_result_size)])
+        else:
+            response_sizes.append([key.upper(), RESPONSE_HEADER_MAX_SIZE + max_result_size if max_result_size else None])
+
+    dispatcher_limits = limits_index(loosest_limits(all_limits))
 
     template_args = {
         'rpc_functions': rpc_functions,
-        'salt1': ', '.join("0x{:02X}".format(x) for x in f1.salt),
-        'salt2': ', '.join("0x{:02X}".format(x) for x in f2.salt),
+        'typed_functions': typed_functions,
+        'result_schemas': result_schemas,
+        'response_sizes': response_sizes,
+        'max_response_size': max_response_size(x[1] for x in response_sizes),
+        'prefix': prefix,
+        'salts': ', '.join("0x{:02X}, 0x{:02X}".format(x, y) for x, y in zip(f1.salt, f2.salt)),
         'graph': ', '.join(str(x) for x in G),
-        'keys': ', '.join('"{}"'.format(x) for x in rpc_funcs)
+        'key_lengths': ', '.join(str(len(x)) for x in rpc_funcs),
+        'builtin_results': format_bytes(funcs_result + schema_result),
+        'funcs_result_size': len(funcs_result),
+        'cache': {"slots": cache_slots, "slot_size": cache_slot_size} if any(x["cacheable"] for x in rpc_functions)
+                 else None,
+        'limit_sets': [', '.join("SIZE_MAX" if x is None else str(x) for x in limit_set) for limit_set in limit_sets],
+        'dispatcher_limits': dispatcher_limits
     }
 
-    with open(os.path.join(path, "rpc_api.c"), 'w') as f:
+    with open(os.path.join(path, prefix + "_api.c"), 'w') as f:
         f.write(c_template.render(**template_args))
         f.write("\n")  # add a new line for pedantic warnings
 
-    with open(os.path.join(path, "rpc_api.h"), 'w') as f:
+    with open(os.path.join(path, prefix + "_api.h"), 'w') as f:
         f.write(h_template.render(**template_args))
         f.write("\n")
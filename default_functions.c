@@ -1,12 +1,13 @@
 #include <stddef.h>
 #include "cbor.h"
 #include "simplecborrpc.h"
+#include "default_functions.h"
+#include "rpc_internal.h"
 
-rpc_error_t
-rpc___funcs(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+rpc_error_t rpc_encode_function_list(const rpc_dispatcher_t *dispatcher, CborEncoder *result) {
     size_t count = 0;
-    for (size_t i=0; i<rpc_get_key_count(); i++) {
-        const char *key = rpc_lookup_key_by_index(i);
+    for (size_t i=0; i<rpc_get_key_count(dispatcher); i++) {
+        const char *key = rpc_lookup_key_by_index(dispatcher, i);
         if (key == NULL || key[0] == '_') continue;
         count++;
     }
@@ -14,8 +15,8 @@ rpc___funcs(const CborValue *args_iterator, CborEncoder *result, const char **er
     CborEncoder map_encoder;
     cbor_encoder_create_map(result, &map_encoder, count);
 
-    for (size_t i=0; i<rpc_get_key_count(); i++) {
-        const char *key = rpc_lookup_key_by_index(i);
+    for (size_t i=0; i<rpc_get_key_count(dispatcher); i++) {
+        const char *key = rpc_lookup_key_by_index(dispatcher, i);
         if (key == NULL || key[0] == '_') continue;
 
         cbor_encode_text_stringz(&map_encoder, key);
@@ -29,6 +30,95 @@ rpc___funcs(const CborValue *args_iterator, CborEncoder *result, const char **er
     return RPC_OK;
 }
 
+#ifdef SIMPLECBORRPC_ENABLE_STATS
+#define STATS_LOAD(X) __atomic_load_n(&(X), __ATOMIC_RELAXED)
+
+// latency histograms are sent up to their last non-empty bucket
+static void encode_histogram(CborEncoder *encoder, const uint32_t *histogram) {
+    size_t length = SIMPLECBORRPC_STATS_BUCKETS;
+    while (length > 0 && STATS_LOAD(histogram[length - 1]) == 0) length--;
+
+    CborEncoder array_encoder;
+    cbor_encoder_create_array(encoder, &array_encoder, length);
+    for (size_t i = 0; i < length; i++) cbor_encode_uint(&array_encoder, STATS_LOAD(histogram[i]));
+    cbor_encoder_close_container(encoder, &array_encoder);
+}
+#endif
+
+// {"bytes": [<request bytes>, <response bytes>], "errors": {<code>: <count>, "other": <count>},
+//  "phases": {"parse": <histogram>, "validate": .., "handler": .., "encode": ..},
+//  "functions": {<name>: [<calls>, <errors>, <histogram>]}}, only errors and functions that were counted are listed
+rpc_error_t rpc_encode_stats(const rpc_dispatcher_t *dispatcher, CborEncoder *result) {
+#ifdef SIMPLECBORRPC_ENABLE_STATS
+    static const char *const phase_names[RPC_STATS_PHASE_COUNT] = {"parse", "validate", "handler", "encode"};
+    rpc_stats_t *stats = dispatcher->stats;
+
+    CborEncoder map_encoder, inner_encoder;
+    cbor_encoder_create_map(result, &map_encoder, 4);
+
+    cbor_encode_text_stringz(&map_encoder, "bytes");
+    cbor_encoder_create_array(&map_encoder, &inner_encoder, 2);
+    cbor_encode_uint(&inner_encoder, STATS_LOAD(stats->request_bytes));
+    cbor_encode_uint(&inner_encoder, STATS_LOAD(stats->response_bytes));
+    cbor_encoder_close_container(&map_encoder, &inner_encoder);
+
+    size_t count = 0;
+    for (size_t i = 0; i < RPC_STATS_ERROR_KINDS; i++) {
+        if (STATS_LOAD(stats->errors[i]) != 0) count++;
+    }
+
+    cbor_encode_text_stringz(&map_encoder, "errors");
+    cbor_encoder_create_map(&map_encoder, &inner_encoder, count);
+    for (size_t i = 0; i < RPC_STATS_ERROR_KINDS; i++) {
+        uint32_t errors = STATS_LOAD(stats->errors[i]);
+        if (errors == 0) continue;
+
+        if (i < RPC_STATS_ERROR_KINDS - 1) cbor_encode_int(&inner_encoder, rpc_stats_error_codes[i]);
+        else cbor_encode_text_stringz(&inner_encoder, "other");
+        cbor_encode_uint(&inner_encoder, errors);
+    }
+    cbor_encoder_close_container(&map_encoder, &inner_encoder);
+
+    cbor_encode_text_stringz(&map_encoder, "phases");
+    cbor_encoder_create_map(&map_encoder, &inner_encoder, RPC_STATS_PHASE_COUNT);
+    for (size_t i = 0; i < RPC_STATS_PHASE_COUNT; i++) {
+        cbor_encode_text_stringz(&inner_encoder, phase_names[i]);
+        encode_histogram(&inner_encoder, stats->phases[i]);
+    }
+    cbor_encoder_close_container(&map_encoder, &inner_encoder);
+
+    count = 0;
+    for (size_t i = 0; i < rpc_get_key_count(dispatcher); i++) {
+        if (STATS_LOAD(stats->functions[i].calls) != 0) count++;
+    }
+
+    cbor_encode_text_stringz(&map_encoder, "functions");
+    cbor_encoder_create_map(&map_encoder, &inner_encoder, count);
+    for (size_t i = 0; i < rpc_get_key_count(dispatcher); i++) {
+        const rpc_function_stats_t *function = &stats->functions[i];
+        uint32_t calls = STATS_LOAD(function->calls);
+        if (calls == 0) continue;
+
+        CborEncoder function_encoder;
+        cbor_encode_text_stringz(&inner_encoder, rpc_lookup_key_by_index(dispatcher, i));
+        cbor_encoder_create_array(&inner_encoder, &function_encoder, 3);
+        cbor_encode_uint(&function_encoder, calls);
+        cbor_encode_uint(&function_encoder, STATS_LOAD(function->errors));
+        encode_histogram(&function_encoder, function->latency);
+        cbor_encoder_close_container(&inner_encoder, &function_encoder);
+    }
+    cbor_encoder_close_container(&map_encoder, &inner_encoder);
+
+    if (cbor_encoder_close_container(result, &map_encoder) != CborNoError) {
+        return RPC_ERROR_ENCODE_ERROR;
+    }
+
+    return RPC_OK;
+#else
+    return RPC_ERROR_METHOD_NOT_FOUND;
+#endif
+}
+
 rpc_error_t
 rpc___ping(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
     cbor_encode_text_stringz(result, "pong");
@@ -42,3 +132,20 @@ rpc___version(const CborValue *args_iterator, CborEncoder *result, const char **
 
     return RPC_OK;
 }
+
+rpc_error_t
+rpc___compact(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    CborEncoder map_encoder;
+    cbor_encoder_create_map(result, &map_encoder, RPC_KEY_COUNT);
+
+    for (size_t i = 0; i < RPC_KEY_COUNT; i++) {
+        cbor_encode_text_string(&map_encoder, RPC_TEXT_KEY_NAME(i), RPC_TEXT_KEY_NAME_LENGTH(i));
+        cbor_encode_uint(&map_encoder, i);
+    }
+
+    if (cbor_encoder_close_container(result, &map_encoder) != CborNoError) {
+        return RPC_ERROR_ENCODE_ERROR;
+    }
+
+    return RPC_OK;
+}
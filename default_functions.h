@@ -5,4 +5,14 @@
 #ifndef SIMPLECBORRPC_DEFAULT_FUNCTIONS_H
 #define SIMPLECBORRPC_DEFAULT_FUNCTIONS_H
 
+#include "simplecborrpc.h"
+
+// Encodes the {name: index} map returned by __funcs. The generated tables answer __funcs from a map api_gen.py
+// encoded ahead of time, this walks the dispatcher for tables that are put together otherwise.
+rpc_error_t rpc_encode_function_list(const rpc_dispatcher_t *dispatcher, CborEncoder *result);
+
+// Encodes the counters returned by __stats; like __funcs, every table gets its own __stats. Without
+// SIMPLECBORRPC_ENABLE_STATS nothing is counted and RPC_ERROR_METHOD_NOT_FOUND is returned.
+rpc_error_t rpc_encode_stats(const rpc_dispatcher_t *dispatcher, CborEncoder *result);
+
 #endif //SIMPLECBORRPC_DEFAULT_FUNCTIONS_H
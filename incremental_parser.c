@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+#include "incremental_parser.h"
+
+static void reset_scan_state(rpc_incremental_parser_t *parser) {
+    parser->scan_offset = 0;
+    parser->skip = 0;
+    parser->depth = 0;
+    parser->status = RPC_PARSER_NEED_MORE;
+}
+
+void rpc_incremental_parser_init(rpc_incremental_parser_t *parser, uint8_t *buffer, size_t buffer_size) {
+    parser->buffer = buffer;
+    parser->buffer_size = buffer_size;
+    parser->used = 0;
+
+    reset_scan_state(parser);
+}
+
+// marks one data item as finished, closing every container that it completes
+static void item_done(rpc_incremental_parser_t *parser) {
+    while (parser->depth > 0) {
+        if (--parser->pending[parser->depth - 1] > 0) return;
+        parser->depth--;
+    }
+
+    parser->status = RPC_PARSER_COMPLETE;
+}
+
+static rpc_parser_status_t scan(rpc_incremental_parser_t *parser) {
+    while (parser->status == RPC_PARSER_NEED_MORE) {
+        if (parser->skip > 0) {
+            // string payload, possibly spread over several feeds
+            size_t available = parser->used - parser->scan_offset;
+            if (available == 0) break;
+
+            size_t count = parser->skip < available ? (size_t) parser->skip : available;
+            parser->scan_offset += count;
+            parser->skip -= count;
+
+            if (parser->skip == 0) item_done(parser);
+            continue;
+        }
+
+        if (parser->scan_offset >= parser->used) break;
+
+        const uint8_t *header = parser->buffer + parser->scan_offset;
+        const uint8_t major_type = header[0] >> 5;
+        const uint8_t additional_info = header[0] & 0x1F;
+
+        // indefinite lengths and reserved values are not accepted in requests
+        if (additional_info > 27) {
+            parser->status = RPC_PARSER_ERROR;
+            break;
+        }
+
+        size_t header_size = 1;
+        if (additional_info >= 24) header_size += (size_t) 1 << (additional_info - 24);
+
+        // wait until the whole header is available, only the header is looked at again on the next feed
+        if (parser->used - parser->scan_offset < header_size) break;
+
+        uint64_t value = additional_info;
+        if (additional_info >= 24) {
+            value = 0;
+            for (size_t i = 1; i < header_size; i++) value = (value << 8) | header[i];
+        }
+
+        parser->scan_offset += header_size;
+
+        switch (major_type) {
+            case 2: // byte string
+            case 3: // text string
+                if (value > parser->buffer_size - parser->scan_offset) {
+                    parser->status = RPC_PARSER_ERROR;
+                } else if (value == 0) {
+                    item_done(parser);
+                } else {
+                    parser->skip = value;
+                }
+                break;
+
+            case 4: // array
+            case 5: // map
+                if (major_type == 5) {
+                    if (value > UINT64_MAX / 2) {
+                        parser->status = RPC_PARSER_ERROR;
+                        break;
+                    }
+                    value *= 2;
+                }
+
+                if (value == 0) {
+                    item_done(parser);
+                } else if (parser->depth == RPC_INCREMENTAL_PARSER_MAX_DEPTH) {
+                    parser->status = RPC_PARSER_ERROR;
+                } else {
+                    parser->pending[parser->depth++] = value;
+                }
+                break;
+
+            case 6: // tag, belongs to the item that follows
+                break;
+
+            default: // integers, simple values and floats are complete once their header is
+                item_done(parser);
+                break;
+        }
+    }
+
+    if (parser->status == RPC_PARSER_NEED_MORE && parser->used == parser->buffer_size) {
+        // the request can never fit
+        parser->status = RPC_PARSER_ERROR;
+    }
+
+    return parser->status;
+}
+
+uint8_t *rpc_incremental_parser_get_write_buffer(rpc_incremental_parser_t *parser, size_t *available) {
+    *available = parser->buffer_size - parser->used;
+    return parser->buffer + parser->used;
+}
+
+rpc_parser_status_t rpc_incremental_parser_commit(rpc_incremental_parser_t *parser, size_t size) {
+    if (size > parser->buffer_size - parser->used) size = parser->buffer_size - parser->used;
+    parser->used += size;
+
+    return scan(parser);
+}
+
+rpc_parser_status_t
+rpc_incremental_parser_feed(rpc_incremental_parser_t *parser, const uint8_t *data, size_t size, size_t *consumed) {
+    *consumed = 0;
+    if (parser->status != RPC_PARSER_NEED_MORE) return parser->status;
+
+    size_t available;
+    uint8_t *write_buffer = rpc_incremental_parser_get_write_buffer(parser, &available);
+    if (size > available) size = available;
+
+    memcpy(write_buffer, data, size);
+    rpc_parser_status_t status = rpc_incremental_parser_commit(parser, size);
+
+    // bytes behind the end of a completed request stay in the buffer for the next one
+    *consumed = size;
+    return status;
+}
+
+bool rpc_incremental_parser_get_request(const rpc_incremental_parser_t *parser, const uint8_t **request,
+                                        size_t *request_size) {
+    if (parser->status != RPC_PARSER_COMPLETE) return false;
+
+    *request = parser->buffer;
+    *request_size = parser->scan_offset;
+    return true;
+}
+
+rpc_parser_status_t rpc_incremental_parser_reset(rpc_incremental_parser_t *parser) {
+    if (parser->status == RPC_PARSER_COMPLETE) {
+        size_t leftover = parser->used - parser->scan_offset;
+        memmove(parser->buffer, parser->buffer + parser->scan_offset, leftover);
+        parser->used = leftover;
+    } else {
+        parser->used = 0;
+    }
+
+    reset_scan_state(parser);
+    return scan(parser);
+}
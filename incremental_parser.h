@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLECBORRPC_INCREMENTAL_PARSER_H
+#define SIMPLECBORRPC_INCREMENTAL_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Maximum container nesting of a request accepted by the incremental parser
+#ifndef RPC_INCREMENTAL_PARSER_MAX_DEPTH
+#define RPC_INCREMENTAL_PARSER_MAX_DEPTH 16
+#endif
+
+typedef enum {
+    RPC_PARSER_NEED_MORE = 0,
+    RPC_PARSER_COMPLETE,
+    RPC_PARSER_ERROR
+} rpc_parser_status_t;
+
+// Accumulates a request as it arrives and tracks where the current CBOR item ends. The scan state (nesting stack and
+// the number of string bytes still to be skipped) is kept between feeds, so each byte is only examined once.
+typedef struct {
+    uint8_t *buffer;
+    size_t buffer_size;
+    size_t used;
+
+    size_t scan_offset;
+    uint64_t skip;
+    size_t depth;
+    uint64_t pending[RPC_INCREMENTAL_PARSER_MAX_DEPTH];
+
+    rpc_parser_status_t status;
+} rpc_incremental_parser_t;
+
+void rpc_incremental_parser_init(rpc_incremental_parser_t *parser, uint8_t *buffer, size_t buffer_size);
+
+// Copies as much of data as fits into the parser buffer and scans it; *consumed is set to the number of bytes taken.
+// Bytes received after the end of a completed request stay in the buffer and are scanned for the next request by
+// rpc_incremental_parser_reset. Nothing is taken while a completed request has not been reset yet.
+rpc_parser_status_t
+rpc_incremental_parser_feed(rpc_incremental_parser_t *parser, const uint8_t *data, size_t size, size_t *consumed);
+
+// For transports that can write straight into the parser buffer (DMA, read()): returns the free space, then
+// rpc_incremental_parser_commit scans the bytes that were written into it.
+uint8_t *rpc_incremental_parser_get_write_buffer(rpc_incremental_parser_t *parser, size_t *available);
+rpc_parser_status_t rpc_incremental_parser_commit(rpc_incremental_parser_t *parser, size_t size);
+
+// Once RPC_PARSER_COMPLETE was returned, points at the complete request inside the parser buffer, ready to be passed
+// to execute_rpc_call without copying.
+bool rpc_incremental_parser_get_request(const rpc_incremental_parser_t *parser, const uint8_t **request,
+                                        size_t *request_size);
+
+// Drops the completed request (or the data after an error) and keeps any bytes already received for the next one.
+rpc_parser_status_t rpc_incremental_parser_reset(rpc_incremental_parser_t *parser);
+
+#endif //SIMPLECBORRPC_INCREMENTAL_PARSER_H
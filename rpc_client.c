@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+#include "rpc_client.h"
+#include "rpc_internal.h"
+
+// {map header, "id": <uint64>, "func": <index>, "args": <array header>}
+#define REQUEST_HEADER_MAX_SIZE (1 + 3 + 9 + 5 + 9 + 5 + 9)
+
+static size_t write_key(uint8_t *head, rpc_key_t key) {
+    memcpy(head, rpc_text_keys[key], RPC_TEXT_KEY_SIZE(key));
+    return RPC_TEXT_KEY_SIZE(key);
+}
+
+void rpc_client_request_init(rpc_client_request_t *request, uint8_t *buffer, size_t size, uint64_t transaction_id,
+                             size_t function_index, size_t argument_count) {
+    uint8_t header[REQUEST_HEADER_MAX_SIZE];
+    size_t used = rpc_encode_head(header, 5, transaction_id != 0 ? 3 : 2);
+
+    if (transaction_id != 0) {
+        used += write_key(header + used, RPC_KEY_ID);
+        used += rpc_encode_head(header + used, 0, transaction_id);
+    }
+
+    used += write_key(header + used, RPC_KEY_FUNC);
+    used += rpc_encode_head(header + used, 0, function_index);
+    used += write_key(header + used, RPC_KEY_ARGS);
+    used += rpc_encode_head(header + used, 4, argument_count);
+
+    request->buffer = buffer;
+    request->size = size;
+    request->overflow = used > size;
+
+    if (request->overflow) {
+        request->encoder_start = 0;
+        cbor_encoder_init(&request->args, buffer, 0, 0);
+        return;
+    }
+
+    memcpy(buffer, header, used);
+    request->encoder_start = used;
+    cbor_encoder_init(&request->args, buffer + used, size - used, 0);
+}
+
+CborError rpc_client_append_encoded(rpc_client_request_t *request, const uint8_t *data, size_t size) {
+    if (request->overflow || cbor_encoder_get_extra_bytes_needed(&request->args) != 0) {
+        request->overflow = true;
+        return CborErrorOutOfMemory;
+    }
+
+    size_t used = request->encoder_start +
+                  cbor_encoder_get_buffer_size(&request->args, request->buffer + request->encoder_start);
+    if (size > request->size - used) {
+        request->overflow = true;
+        return CborErrorOutOfMemory;
+    }
+
+    memcpy(request->buffer + used, data, size);
+    used += size;
+
+    // the following arguments are encoded behind the copied ones
+    request->encoder_start = used;
+    cbor_encoder_init(&request->args, request->buffer + used, request->size - used, 0);
+    return CborNoError;
+}
+
+size_t rpc_client_request_finish(rpc_client_request_t *request) {
+    if (request->overflow || cbor_encoder_get_extra_bytes_needed(&request->args) != 0) return 0;
+
+    return request->encoder_start +
+           cbor_encoder_get_buffer_size(&request->args, request->buffer + request->encoder_start);
+}
+
+// returns the rpc_key_t of the key at it, or RPC_KEY_UNKNOWN
+static int read_key(const CborValue *it, bool *compact) {
+    if (cbor_value_is_unsigned_integer(it)) {
+        uint64_t key;
+        cbor_value_get_uint64(it, &key);
+
+        *compact = true;
+        return key <= RPC_KEY_MSG ? (int) key : RPC_KEY_UNKNOWN;
+    }
+
+    const char *text;
+    size_t length;
+
+    *compact = false;
+    if (rpc_get_text_string_view(it, &text, &length) != RPC_OK) return RPC_KEY_UNKNOWN;
+
+    for (size_t i = 0; i < RPC_KEY_COUNT; i++) {
+        if (length == RPC_TEXT_KEY_NAME_LENGTH(i) && memcmp(text, RPC_TEXT_KEY_NAME(i), length) == 0) return (int) i;
+    }
+
+    return RPC_KEY_UNKNOWN;
+}
+
+// {"c": <code>, "msg": <text>}, keys of the same kind as the rest of the response
+static bool decode_error(rpc_client_response_t *response, CborValue *err_it) {
+    CborValue map_it;
+    bool has_code = false;
+
+    if (!cbor_value_is_map(err_it) || cbor_value_enter_container(err_it, &map_it) != CborNoError) return false;
+
+    while (!cbor_value_at_end(&map_it)) {
+        bool compact;
+        int key = read_key(&map_it, &compact);
+        if (compact != response->compact || cbor_value_advance(&map_it) != CborNoError) return false;
+
+        if (key == RPC_KEY_CODE && cbor_value_is_integer(&map_it)) {
+            int64_t code;
+            cbor_value_get_int64(&map_it, &code);
+
+            response->error = (rpc_error_t) code;
+            has_code = true;
+        } else if (key == RPC_KEY_MSG) {
+            if (rpc_get_text_string_view(&map_it, &response->error_msg, &response->error_msg_length) != RPC_OK) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+
+        if (cbor_value_advance(&map_it) != CborNoError) return false;
+    }
+
+    return has_code && response->error != RPC_OK && cbor_value_leave_container(err_it, &map_it) == CborNoError;
+}
+
+rpc_error_t rpc_client_decode_response(rpc_client_response_t *response, const uint8_t *buffer, size_t size) {
+    CborValue it, map_it;
+    bool has_result = false;
+    bool has_error = false;
+
+    response->transaction_id = 0;
+    response->compact = false;
+    response->error = RPC_OK;
+    response->error_msg = NULL;
+    response->error_msg_length = 0;
+
+    if (cbor_parser_init(buffer, size, 0, &response->parser, &it) != CborNoError || !cbor_value_is_map(&it) ||
+        cbor_value_enter_container(&it, &map_it) != CborNoError) {
+        return RPC_ERROR_PARSE_ERROR;
+    }
+
+    bool first_key = true;
+    while (!cbor_value_at_end(&map_it)) {
+        bool compact;
+        int key = read_key(&map_it, &compact);
+
+        if (first_key) {
+            response->compact = compact;
+            first_key = false;
+        } else if (compact != response->compact) {
+            return RPC_ERROR_PARSE_ERROR;
+        }
+
+        if (cbor_value_advance(&map_it) != CborNoError) return RPC_ERROR_PARSE_ERROR;
+
+        switch (key) {
+            case RPC_KEY_ID:
+                if (!cbor_value_is_unsigned_integer(&map_it)) return RPC_ERROR_PARSE_ERROR;
+                cbor_value_get_uint64(&map_it, &response->transaction_id);
+                break;
+
+            case RPC_KEY_RES:
+                response->result = map_it;
+                has_result = true;
+                break;
+
+            case RPC_KEY_ERR:
+                // decode_error steps over the error map itself
+                if (!decode_error(response, &map_it)) return RPC_ERROR_PARSE_ERROR;
+                has_error = true;
+                continue;
+
+            default:
+                return RPC_ERROR_PARSE_ERROR;
+        }
+
+        if (cbor_value_advance(&map_it) != CborNoError) return RPC_ERROR_PARSE_ERROR;
+    }
+
+    if (has_result == has_error) return RPC_ERROR_PARSE_ERROR;
+    return RPC_OK;
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLECBORRPC_RPC_CLIENT_H
+#define SIMPLECBORRPC_RPC_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "simplecborrpc.h"
+
+// Writes one request straight into a caller buffer, usually through the <prefix>_client_<name> encoders api_gen.py
+// generates. The function is called by its index, so the server never has to hash the name.
+typedef struct {
+    // the arguments are encoded with this, one after the other
+    CborEncoder args;
+
+    uint8_t *buffer;
+    size_t size;
+    size_t encoder_start;   // where args started writing
+
+    bool overflow;
+} rpc_client_request_t;
+
+// Starts {"id": transaction_id, "func": function_index, "args": [...]} with room for argument_count arguments. The
+// id is left out when transaction_id is 0, like the server does in its responses.
+void rpc_client_request_init(rpc_client_request_t *request, uint8_t *buffer, size_t size, uint64_t transaction_id,
+                             size_t function_index, size_t argument_count);
+
+// Copies an argument that is already CBOR encoded, e.g. an array or map built elsewhere
+CborError rpc_client_append_encoded(rpc_client_request_t *request, const uint8_t *data, size_t size);
+
+// Returns the size of the request, or 0 if it did not fit in the buffer
+size_t rpc_client_request_finish(rpc_client_request_t *request);
+
+// A decoded response. result and error_msg point into the response buffer, which has to outlive them; result also
+// refers to parser, so the struct must not be copied while result is in use.
+typedef struct {
+    CborParser parser;
+
+    uint64_t transaction_id;
+    bool compact;
+
+    // RPC_OK for a result, the error code of an error response otherwise
+    rpc_error_t error;
+
+    CborValue result;
+
+    // not null terminated, NULL if the error response had no message
+    const char *error_msg;
+    size_t error_msg_length;
+} rpc_client_response_t;
+
+// Decodes a response with text or compact keys. Returns RPC_OK if it is a well-formed result or error response,
+// response->error then tells which; RPC_ERROR_PARSE_ERROR otherwise.
+rpc_error_t rpc_client_decode_response(rpc_client_response_t *response, const uint8_t *buffer, size_t size);
+
+#endif //SIMPLECBORRPC_RPC_CLIENT_H
@@ -0,0 +1,321 @@
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+#include "rpc_framing.h"
+
+#define LENGTH_PREFIX_SIZE 2
+
+// the code byte in front of every block of up to 254 non-zero bytes, plus the delimiter
+#define COBS_OVERHEAD(size) (1 + (size) / 254)
+#define COBS_DELIMITER 0x00
+
+// Decodes a COBS frame (without its delimiter) in place. The output never gets ahead of the input, so every block is
+// simply moved down over the code bytes that were already read.
+static bool cobs_decode(uint8_t *data, size_t size, size_t *decoded_size) {
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < size) {
+        const uint8_t code = data[in++];
+        const size_t count = code - 1u;
+
+        if (code == COBS_DELIMITER || count > size - in) return false;
+
+        memmove(data + out, data + in, count);
+        in += count;
+        out += count;
+
+        // a full block is not followed by a zero, neither is the last block
+        if (code != 0xFF && in < size) data[out++] = 0;
+    }
+
+    *decoded_size = out;
+    return true;
+}
+
+// Encodes size bytes found at data + offset to the start of data. With offset at least COBS_OVERHEAD(size), the
+// output stays behind the input byte that is read next, so the response does not need a second buffer.
+static size_t cobs_encode(uint8_t *data, size_t offset, size_t size) {
+    size_t code_position = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < size; i++) {
+        const uint8_t byte = data[offset + i];
+
+        if (byte != 0) {
+            data[out++] = byte;
+            if (++code != 0xFF) continue;
+        }
+
+        data[code_position] = code;
+        code_position = out++;
+        code = 1;
+    }
+
+    data[code_position] = code;
+    return out;
+}
+
+void rpc_frame_reader_init(rpc_frame_reader_t *reader, rpc_framing_mode_t mode, uint8_t *buffer, size_t size) {
+    reader->mode = mode;
+    reader->buffer = buffer;
+    reader->size = size;
+    reader->read = 0;
+    reader->write = 0;
+    reader->scan = 0;
+    reader->frame_end = 0;
+    reader->frame_size = 0;
+    reader->discard = 0;
+}
+
+uint8_t *rpc_frame_reader_get_write_buffer(rpc_frame_reader_t *reader, size_t *available) {
+    if (reader->frame_end == 0 && reader->read > 0) {
+        if (reader->read == reader->write) {
+            reader->read = reader->write = reader->scan = 0;
+        } else if (reader->write == reader->size) {
+            // only the start of a frame that has not been received completely is ever moved
+            size_t leftover = reader->write - reader->read;
+            memmove(reader->buffer, reader->buffer + reader->read, leftover);
+            reader->scan -= reader->read;
+            reader->write = leftover;
+            reader->read = 0;
+        }
+    }
+
+    *available = reader->size - reader->write;
+    return reader->buffer + reader->write;
+}
+
+void rpc_frame_reader_commit(rpc_frame_reader_t *reader, size_t size) {
+    if (size > reader->size - reader->write) size = reader->size - reader->write;
+    reader->write += size;
+}
+
+// skips what is left of a dropped frame, returns false while the end of it has not been received yet
+static bool skip_discarded(rpc_frame_reader_t *reader) {
+    if (reader->discard == SIZE_MAX) {
+        const uint8_t *delimiter = memchr(reader->buffer + reader->read, COBS_DELIMITER, reader->write - reader->read);
+        if (delimiter == NULL) {
+            reader->read = reader->scan = reader->write;
+            return false;
+        }
+
+        reader->read = reader->scan = (size_t) (delimiter - reader->buffer) + 1;
+        reader->discard = 0;
+        return true;
+    }
+
+    size_t count = reader->write - reader->read;
+    if (count > reader->discard) count = reader->discard;
+
+    reader->read = reader->scan = reader->read + count;
+    reader->discard -= count;
+    return reader->discard == 0;
+}
+
+static rpc_frame_status_t next_length_prefixed(rpc_frame_reader_t *reader, const uint8_t **frame, size_t *frame_size) {
+    const size_t available = reader->write - reader->read;
+    if (available < LENGTH_PREFIX_SIZE) return RPC_FRAME_NEED_MORE;
+
+    const uint8_t *header = reader->buffer + reader->read;
+    const size_t length = ((size_t) header[0] << 8) | header[1];
+
+    if (length > reader->size - LENGTH_PREFIX_SIZE) {
+        reader->read += LENGTH_PREFIX_SIZE;
+        reader->scan = reader->read;
+        reader->discard = length;
+        skip_discarded(reader);
+        return RPC_FRAME_DROPPED;
+    }
+
+    if (available - LENGTH_PREFIX_SIZE < length) return RPC_FRAME_NEED_MORE;
+
+    *frame = header + LENGTH_PREFIX_SIZE;
+    *frame_size = reader->frame_size = length;
+    reader->frame_end = reader->read + LENGTH_PREFIX_SIZE + length;
+    return RPC_FRAME_COMPLETE;
+}
+
+static rpc_frame_status_t next_cobs(rpc_frame_reader_t *reader, const uint8_t **frame, size_t *frame_size) {
+    for (;;) {
+        const uint8_t *delimiter = memchr(reader->buffer + reader->scan, COBS_DELIMITER, reader->write - reader->scan);
+
+        if (delimiter == NULL) {
+            reader->scan = reader->write;
+
+            if (reader->read == 0 && reader->write == reader->size) {
+                // the frame can never fit, drop everything up to its delimiter
+                reader->read = reader->write;
+                reader->discard = SIZE_MAX;
+                return RPC_FRAME_DROPPED;
+            }
+
+            return RPC_FRAME_NEED_MORE;
+        }
+
+        const size_t end = (size_t) (delimiter - reader->buffer);
+        uint8_t *data = reader->buffer + reader->read;
+        const size_t encoded_size = end - reader->read;
+
+        if (encoded_size == 0) {
+            // empty frames are used to resynchronise, there is nothing to answer
+            reader->read = reader->scan = end + 1;
+            continue;
+        }
+
+        if (!cobs_decode(data, encoded_size, &reader->frame_size)) {
+            reader->read = reader->scan = end + 1;
+            return RPC_FRAME_DROPPED;
+        }
+
+        *frame = data;
+        *frame_size = reader->frame_size;
+        reader->scan = end;
+        reader->frame_end = end + 1;
+        return RPC_FRAME_COMPLETE;
+    }
+}
+
+rpc_frame_status_t rpc_frame_reader_next(rpc_frame_reader_t *reader, const uint8_t **frame, size_t *frame_size) {
+    if (reader->frame_end != 0) {
+        // the frame handed out last has not been released, it is already decoded and sits at the same place
+        *frame = reader->buffer + reader->read + (reader->mode == RPC_FRAMING_COBS ? 0 : LENGTH_PREFIX_SIZE);
+        *frame_size = reader->frame_size;
+        return RPC_FRAME_COMPLETE;
+    }
+    if (reader->discard != 0 && !skip_discarded(reader)) return RPC_FRAME_NEED_MORE;
+
+    if (reader->mode == RPC_FRAMING_COBS) return next_cobs(reader, frame, frame_size);
+    return next_length_prefixed(reader, frame, frame_size);
+}
+
+void rpc_frame_reader_release(rpc_frame_reader_t *reader) {
+    if (reader->frame_end == 0) return;
+
+    reader->read = reader->scan = reader->frame_end;
+    reader->frame_end = 0;
+}
+
+void rpc_frame_writer_init(rpc_frame_writer_t *writer, rpc_framing_mode_t mode, uint8_t *buffer, size_t size) {
+    writer->mode = mode;
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->read = 0;
+    writer->write = 0;
+    writer->wrap = 0;
+}
+
+// finds needed contiguous free bytes, at the start of the buffer if they do not fit behind write
+static bool writer_reserve(rpc_frame_writer_t *writer, size_t needed, size_t *position) {
+    if (writer->wrap != 0) {
+        if (writer->read - writer->write < needed) return false;
+        *position = writer->write;
+        return true;
+    }
+
+    if (writer->read == writer->write) writer->read = writer->write = 0;
+
+    if (writer->size - writer->write >= needed) {
+        *position = writer->write;
+    } else if (writer->read >= needed) {
+        *position = 0;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static void writer_commit(rpc_frame_writer_t *writer, size_t position, size_t size) {
+    // the data at the top of the buffer ends where write was, it is sent before the frame at the start
+    if (position != writer->write) writer->wrap = writer->write;
+    writer->write = position + size;
+}
+
+// the bytes reserved for a response of up to *max_response_size together with its framing, the response is encoded
+// header_size bytes into them; length-prefixed responses are limited to what the prefix can express
+static size_t frame_reservation(rpc_framing_mode_t mode, size_t *max_response_size, size_t *header_size) {
+    if (mode == RPC_FRAMING_COBS) {
+        *header_size = COBS_OVERHEAD(*max_response_size);
+        return *header_size + *max_response_size + 1;
+    }
+
+    if (*max_response_size > UINT16_MAX) *max_response_size = UINT16_MAX;
+    *header_size = LENGTH_PREFIX_SIZE;
+    return LENGTH_PREFIX_SIZE + *max_response_size;
+}
+
+bool rpc_frame_writer_execute(rpc_frame_writer_t *writer, const rpc_dispatcher_t *dispatcher, const uint8_t *request,
+                              size_t request_size, size_t max_response_size, rpc_error_t *result, void *user_ptr) {
+    size_t header_size;
+    size_t position;
+
+    size_t needed = frame_reservation(writer->mode, &max_response_size, &header_size);
+    if (!writer_reserve(writer, needed, &position)) return false;
+
+    uint8_t *frame = writer->buffer + position;
+    size_t response_size = max_response_size;
+    rpc_error_t err = execute_rpc_call(dispatcher, request, request_size, frame + header_size, &response_size,
+                                       user_ptr);
+    if (result != NULL) *result = err;
+
+    // not even the canned error response fitted
+    if (response_size == 0) return true;
+
+    size_t frame_size;
+    if (writer->mode == RPC_FRAMING_COBS) {
+        frame_size = cobs_encode(frame, header_size, response_size);
+        frame[frame_size++] = COBS_DELIMITER;
+    } else {
+        frame[0] = (uint8_t) (response_size >> 8);
+        frame[1] = (uint8_t) response_size;
+        frame_size = LENGTH_PREFIX_SIZE + response_size;
+    }
+
+    writer_commit(writer, position, frame_size);
+    return true;
+}
+
+const uint8_t *rpc_frame_writer_peek(const rpc_frame_writer_t *writer, size_t *size) {
+    const size_t end = writer->wrap != 0 ? writer->wrap : writer->write;
+
+    *size = end - writer->read;
+    return writer->buffer + writer->read;
+}
+
+void rpc_frame_writer_consume(rpc_frame_writer_t *writer, size_t size) {
+    size_t available;
+    rpc_frame_writer_peek(writer, &available);
+    if (size > available) size = available;
+
+    writer->read += size;
+
+    if (writer->wrap != 0 && writer->read == writer->wrap) {
+        writer->read = 0;
+        writer->wrap = 0;
+    }
+}
+
+rpc_error_t rpc_framing_process(rpc_frame_reader_t *reader, rpc_frame_writer_t *writer,
+                                const rpc_dispatcher_t *dispatcher, size_t max_response_size, void *user_ptr) {
+    // the writer would wait for room forever, even with nothing left to send
+    size_t header_size;
+    size_t response_size = max_response_size;
+    if (frame_reservation(writer->mode, &response_size, &header_size) > writer->size) return RPC_ERROR_INVALID_ARGS;
+
+    for (;;) {
+        const uint8_t *frame;
+        size_t frame_size;
+
+        rpc_frame_status_t status = rpc_frame_reader_next(reader, &frame, &frame_size);
+        if (status == RPC_FRAME_DROPPED) continue;
+        if (status != RPC_FRAME_COMPLETE) return RPC_OK;
+
+        if (!rpc_frame_writer_execute(writer, dispatcher, frame, frame_size, max_response_size, NULL, user_ptr)) {
+            return RPC_OK;
+        }
+
+        rpc_frame_reader_release(reader);
+    }
+}
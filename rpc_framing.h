@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLECBORRPC_RPC_FRAMING_H
+#define SIMPLECBORRPC_RPC_FRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "simplecborrpc.h"
+
+typedef enum {
+    // every frame starts with its length as a 16 bit big endian integer
+    RPC_FRAMING_LENGTH_PREFIX = 0,
+    // consistent overhead byte stuffing, frames are terminated by a zero byte
+    RPC_FRAMING_COBS
+} rpc_framing_mode_t;
+
+typedef enum {
+    RPC_FRAME_NEED_MORE = 0,
+    RPC_FRAME_COMPLETE,
+    // a malformed or oversized frame was discarded, call rpc_frame_reader_next again
+    RPC_FRAME_DROPPED
+} rpc_frame_status_t;
+
+// Receive side. Bytes are written straight into the buffer (DMA, read()) and frames are handed out as pointers into
+// it, COBS frames are decoded in place. Only the unfinished tail is moved back to the start of the buffer when the
+// end of the buffer is reached.
+typedef struct {
+    rpc_framing_mode_t mode;
+
+    uint8_t *buffer;
+    size_t size;
+
+    size_t read;        // start of the first frame that was not released
+    size_t write;       // end of the received data
+    size_t scan;        // where the search for the end of the current frame continues
+    size_t frame_end;   // set while a frame is handed out, 0 otherwise
+    size_t frame_size;
+
+    // bytes of an oversized frame still to be dropped, SIZE_MAX for a COBS frame that ends at the next delimiter
+    size_t discard;
+} rpc_frame_reader_t;
+
+void rpc_frame_reader_init(rpc_frame_reader_t *reader, rpc_framing_mode_t mode, uint8_t *buffer, size_t size);
+
+uint8_t *rpc_frame_reader_get_write_buffer(rpc_frame_reader_t *reader, size_t *available);
+void rpc_frame_reader_commit(rpc_frame_reader_t *reader, size_t size);
+
+// Finds the next complete frame. The frame stays valid until rpc_frame_reader_release is called, until then the same
+// frame is returned again.
+rpc_frame_status_t rpc_frame_reader_next(rpc_frame_reader_t *reader, const uint8_t **frame, size_t *frame_size);
+void rpc_frame_reader_release(rpc_frame_reader_t *reader);
+
+// Transmit side, a bip buffer: every frame is contiguous, so responses are encoded into it directly and handed to
+// the transport as they are.
+typedef struct {
+    rpc_framing_mode_t mode;
+
+    uint8_t *buffer;
+    size_t size;
+
+    size_t read;
+    size_t write;
+    size_t wrap;        // end of the data at the top of the buffer while write has wrapped around, 0 otherwise
+} rpc_frame_writer_t;
+
+void rpc_frame_writer_init(rpc_frame_writer_t *writer, rpc_framing_mode_t mode, uint8_t *buffer, size_t size);
+
+// Executes request and writes the framed response to the transmit buffer. Returns false without executing anything
+// when less than max_response_size plus the framing overhead is free, which is always the case if that is more than
+// the whole buffer; result receives the execute_rpc_call result.
+bool rpc_frame_writer_execute(rpc_frame_writer_t *writer, const rpc_dispatcher_t *dispatcher, const uint8_t *request,
+                              size_t request_size, size_t max_response_size, rpc_error_t *result, void *user_ptr);
+
+// Contiguous framed data ready to be sent, then rpc_frame_writer_consume with the number of bytes that went out.
+const uint8_t *rpc_frame_writer_peek(const rpc_frame_writer_t *writer, size_t *size);
+void rpc_frame_writer_consume(rpc_frame_writer_t *writer, size_t size);
+
+// Answers every complete frame in reader into writer. Stops early, keeping the current frame, when writer is full.
+// Returns RPC_ERROR_INVALID_ARGS without touching reader if max_response_size plus the framing overhead does not fit
+// in the transmit buffer at all, the frames could never be answered then.
+rpc_error_t rpc_framing_process(rpc_frame_reader_t *reader, rpc_frame_writer_t *writer,
+                                const rpc_dispatcher_t *dispatcher, size_t max_response_size, void *user_ptr);
+
+#endif //SIMPLECBORRPC_RPC_FRAMING_H
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLECBORRPC_RPC_INTERNAL_H
+#define SIMPLECBORRPC_RPC_INTERNAL_H
+
+// Encoding helpers shared by the server and the client, not part of the api
+
+#include <stddef.h>
+#include <stdint.h>
+#include "simplecborrpc.h"
+
+#define RPC_KEY_COUNT (RPC_KEY_MSG + 1)
+
+// what the key decoders return for keys that are no rpc_key_t
+#define RPC_KEY_UNKNOWN (-1)
+
+// The text keys as complete CBOR text strings, the one byte head followed by the name; indexed by rpc_key_t. Compact
+// keys are the rpc_key_t itself.
+extern const char *const rpc_text_keys[RPC_KEY_COUNT];
+
+#define RPC_TEXT_KEY_SIZE(key) (1 + (size_t) (rpc_text_keys[key][0] & 0x1F))
+#define RPC_TEXT_KEY_NAME(key) (rpc_text_keys[key] + 1)
+#define RPC_TEXT_KEY_NAME_LENGTH(key) (RPC_TEXT_KEY_SIZE(key) - 1)
+
+// writes the initial byte and argument of a CBOR data item, returns the number of bytes used (at most 9)
+size_t rpc_encode_head(uint8_t *head, uint8_t major_type, uint64_t value);
+
+#endif //SIMPLECBORRPC_RPC_INTERNAL_H
@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: MIT */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rpc_server.h"
+
+#define CACHE_LINE_SIZE 64
+
+// One slot of the bounded MPMC queue (D. Vyukov). The sequence tells producers and consumers whose turn it is: a
+// slot at position pos is free for a producer when sequence == pos and holds a request for a consumer when
+// sequence == pos + 1.
+typedef struct {
+    size_t sequence;
+    size_t request_size;
+    void *reply_ptr;
+    uint8_t *request;
+} rpc_server_slot_t;
+
+typedef struct {
+    rpc_server_t *server;
+    pthread_t thread;
+
+    uint8_t *request_arena;     // traded with a queue slot's buffer on every pop
+    uint8_t *response_arena;
+} rpc_server_worker_t;
+
+struct rpc_server_s {
+    rpc_server_config_t config;
+
+    rpc_server_slot_t *slots;
+    size_t mask;
+
+    // producers and consumers each get their own cache line
+    char padding0[CACHE_LINE_SIZE];
+    size_t enqueue_position;
+    char padding1[CACHE_LINE_SIZE - sizeof(size_t)];
+    size_t dequeue_position;
+    char padding2[CACHE_LINE_SIZE - sizeof(size_t)];
+
+    // counts queued requests so that idle workers sleep instead of spinning
+    sem_t pending;
+    bool stopping;
+
+    rpc_server_worker_t *workers;
+    size_t workers_started;
+
+    uint8_t *memory;
+};
+
+static bool queue_push(rpc_server_t *server, const uint8_t *request, size_t request_size, void *reply_ptr) {
+    rpc_server_slot_t *slot;
+    size_t position = __atomic_load_n(&server->enqueue_position, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &server->slots[position & server->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&server->enqueue_position, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // full
+        } else {
+            position = __atomic_load_n(&server->enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot->request, request, request_size);
+    slot->request_size = request_size;
+    slot->reply_ptr = reply_ptr;
+
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Takes the oldest request by swapping the slot's buffer with the worker's spare one instead of copying it. The slot
+// goes back to the producers before the request is executed, so a slow handler never holds up a queue slot.
+static bool queue_pop(rpc_server_t *server, uint8_t **request, size_t *request_size, void **reply_ptr) {
+    rpc_server_slot_t *slot;
+    size_t position = __atomic_load_n(&server->dequeue_position, __ATOMIC_RELAXED);
+
+    for (;;) {
+        slot = &server->slots[position & server->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&server->dequeue_position, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // empty, or the producer of the oldest slot has not finished writing it
+        } else {
+            position = __atomic_load_n(&server->dequeue_position, __ATOMIC_RELAXED);
+        }
+    }
+
+    uint8_t *spare = *request;
+    *request = slot->request;
+    slot->request = spare;
+    *request_size = slot->request_size;
+    *reply_ptr = slot->reply_ptr;
+
+    __atomic_store_n(&slot->sequence, position + server->mask + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool size_add(size_t a, size_t b, size_t *result) {
+    if (a > SIZE_MAX - b) return false;
+    *result = a + b;
+    return true;
+}
+
+static bool size_multiply(size_t a, size_t b, size_t *result) {
+    if (b != 0 && a > SIZE_MAX / b) return false;
+    *result = a * b;
+    return true;
+}
+
+static void *worker_main(void *arg) {
+    rpc_server_worker_t *worker = (rpc_server_worker_t *) arg;
+    rpc_server_t *server = worker->server;
+    const rpc_server_config_t *config = &server->config;
+
+    for (;;) {
+        while (sem_wait(&server->pending) != 0); // EINTR
+
+        size_t request_size;
+        void *reply_ptr;
+        while (!queue_pop(server, &worker->request_arena, &request_size, &reply_ptr)) {
+            // every post but the ones made by rpc_server_destroy belongs to a request, so an empty queue means its
+            // producer is still copying; once stopping, all producers are done and empty really is empty
+            if (__atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE)) return NULL;
+            sched_yield();
+        }
+
+        size_t response_size = config->max_response_size;
+        rpc_error_t result = execute_rpc_call(config->dispatcher, worker->request_arena, request_size,
+                                              worker->response_arena, &response_size, config->user_ptr);
+
+        config->reply(worker->response_arena, response_size, result, reply_ptr);
+    }
+}
+
+rpc_server_t *rpc_server_create(const rpc_server_config_t *config) {
+    if (config->worker_count == 0 || config->queue_size == 0 || config->reply == NULL) return NULL;
+    if (config->queue_size > SIZE_MAX / 2 + 1) return NULL;
+
+    size_t queue_size = 1;
+    while (queue_size < config->queue_size) queue_size <<= 1;
+
+    // one block for the slot payloads and the worker arenas, the sizes come from the caller so every step is checked
+    size_t arena_size, slots_memory, workers_memory;
+    if (!size_add(config->max_request_size, config->max_response_size, &arena_size) ||
+        !size_multiply(queue_size, config->max_request_size, &slots_memory) ||
+        !size_multiply(config->worker_count, arena_size, &workers_memory) ||
+        slots_memory > SIZE_MAX - workers_memory) {
+        return NULL;
+    }
+
+    rpc_server_t *server = calloc(1, sizeof(rpc_server_t));
+    if (server == NULL) return NULL;
+
+    server->config = *config;
+    server->mask = queue_size - 1;
+
+    server->slots = calloc(queue_size, sizeof(rpc_server_slot_t));
+    server->workers = calloc(config->worker_count, sizeof(rpc_server_worker_t));
+    server->memory = malloc(slots_memory + workers_memory);
+
+    if (server->slots == NULL || server->workers == NULL || server->memory == NULL ||
+        sem_init(&server->pending, 0, 0) != 0) {
+        free(server->memory);
+        free(server->workers);
+        free(server->slots);
+        free(server);
+        return NULL;
+    }
+
+    uint8_t *memory = server->memory;
+    for (size_t i = 0; i < queue_size; i++) {
+        server->slots[i].sequence = i;
+        server->slots[i].request = memory;
+        memory += config->max_request_size;
+    }
+
+    for (size_t i = 0; i < config->worker_count; i++) {
+        rpc_server_worker_t *worker = &server->workers[i];
+        worker->server = server;
+        worker->request_arena = memory;
+        worker->response_arena = memory + config->max_request_size;
+        memory += arena_size;
+    }
+
+    for (size_t i = 0; i < config->worker_count; i++) {
+        if (pthread_create(&server->workers[i].thread, NULL, worker_main, &server->workers[i]) != 0) {
+            rpc_server_destroy(server);
+            return NULL;
+        }
+
+        server->workers_started++;
+    }
+
+    return server;
+}
+
+bool rpc_server_submit(rpc_server_t *server, const uint8_t *request, size_t request_size, void *reply_ptr) {
+    if (request_size > server->config.max_request_size) return false;
+    if (__atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE)) return false;
+
+    if (!queue_push(server, request, request_size, reply_ptr)) return false;
+
+    sem_post(&server->pending);
+    return true;
+}
+
+void rpc_server_destroy(rpc_server_t *server) {
+    __atomic_store_n(&server->stopping, true, __ATOMIC_RELEASE);
+
+    // one extra wake up per worker, each worker leaves once it finds the queue empty
+    for (size_t i = 0; i < server->workers_started; i++) sem_post(&server->pending);
+    for (size_t i = 0; i < server->workers_started; i++) pthread_join(server->workers[i].thread, NULL);
+
+    sem_destroy(&server->pending);
+    free(server->memory);
+    free(server->workers);
+    free(server->slots);
+    free(server);
+}
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLECBORRPC_RPC_SERVER_H
+#define SIMPLECBORRPC_RPC_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "simplecborrpc.h"
+
+// Called from a worker thread with the response to a submitted request. response is only valid during the call. A
+// deferred request is reported with RPC_PENDING and no response, its answer is produced by rpc_complete.
+typedef void (*rpc_server_reply_function_t)(const uint8_t *response, size_t response_size, rpc_error_t result,
+                                            void *reply_ptr);
+
+typedef struct {
+    const rpc_dispatcher_t *dispatcher;
+
+    size_t worker_count;
+    size_t queue_size;          // number of queued requests, rounded up to a power of two
+    size_t max_request_size;
+    size_t max_response_size;   // e.g. RPC_MAX_RESPONSE_SIZE from the generated header
+
+    rpc_server_reply_function_t reply;
+
+    // handed to every rpc function, handlers run concurrently and have to synchronise access to it themselves
+    void *user_ptr;
+} rpc_server_config_t;
+
+typedef struct rpc_server_s rpc_server_t;
+
+// Runs execute_rpc_call on worker_count threads fed from a bounded lock-free queue. All memory (queue slots and a
+// request and a response arena per worker) is allocated here, nothing is allocated once the server is running. The
+// dispatcher, its function table and hash tables are only ever read, so one dispatcher can back any number of
+// workers and servers. Returns NULL if the sizes overflow a size_t or the memory or the threads could not be set up.
+rpc_server_t *rpc_server_create(const rpc_server_config_t *config);
+
+// Copies the request into the queue and returns immediately, the reply function is called with reply_ptr once a
+// worker has executed it. Safe to call from any number of threads. Returns false if the queue is full, the request
+// is larger than max_request_size or the server is being destroyed.
+bool rpc_server_submit(rpc_server_t *server, const uint8_t *request, size_t request_size, void *reply_ptr);
+
+// Executes everything still queued, then stops the workers and frees the server. No rpc_server_submit calls may be
+// running or made afterwards.
+void rpc_server_destroy(rpc_server_t *server);
+
+#endif //SIMPLECBORRPC_RPC_SERVER_H
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "rpc_session.h"
+
+#define SLOT_IN_USE 1u
+
+static rpc_session_handle_t make_handle(size_t index, uint32_t state) {
+    return (rpc_session_handle_t) state << 32 | (rpc_session_handle_t) index;
+}
+
+void rpc_session_init(rpc_session_t *session, rpc_session_slot_t *slots, size_t window) {
+    session->slots = slots;
+    session->window = window;
+    session->in_flight = 0;
+
+    for (size_t i = 0; i < window; i++) slots[i].state = 0;
+}
+
+rpc_error_t rpc_session_defer(rpc_session_t *session, CborEncoder *result, rpc_session_handle_t *handle) {
+    rpc_deferred_t token;
+
+    // only the token is needed from rpc_defer, nothing is outstanding until a slot was taken
+    rpc_error_t err = rpc_defer(result, &token);
+    if (err != RPC_PENDING) return err;
+
+    if (token.transaction_id == 0) return RPC_ERROR_INVALID_REQUEST;
+    if (rpc_session_find(session, token.transaction_id) != RPC_SESSION_NO_SLOT) return RPC_ERROR_INVALID_REQUEST;
+
+    // slots are only taken on this thread, other threads only ever free them
+    for (size_t i = 0; i < session->window; i++) {
+        rpc_session_slot_t *candidate = &session->slots[i];
+        uint32_t state = __atomic_load_n(&candidate->state, __ATOMIC_ACQUIRE);
+        if (state & SLOT_IN_USE) continue;
+
+        // the next call in the slot gets the next state, so handles of the calls before it no longer match
+        state = (state + 2) | SLOT_IN_USE;
+        candidate->token = token;
+        __atomic_store_n(&candidate->state, state, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&session->in_flight, 1, __ATOMIC_RELAXED);
+
+        *handle = make_handle(i, state);
+        return RPC_PENDING;
+    }
+
+    return RPC_ERROR_TOO_MANY_REQUESTS;
+}
+
+rpc_error_t rpc_session_complete(rpc_session_t *session, rpc_session_handle_t handle, rpc_complete_function_t complete,
+                                 void *complete_ptr, uint8_t *output_buffer, size_t *output_buffer_size) {
+    const size_t index = (size_t) (handle & UINT32_MAX);
+    uint32_t state = (uint32_t) (handle >> 32);
+    if (index >= session->window || !(state & SLOT_IN_USE)) return RPC_ERROR_INVALID_ARGS;
+    rpc_session_slot_t *slot = &session->slots[index];
+
+    // The token is copied before the slot is freed, it may be taken again right after. A copy made while the slot
+    // held another call is thrown away: its state differs, so the compare exchange below fails.
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != state) return RPC_ERROR_INVALID_ARGS;
+    rpc_deferred_t token = slot->token;
+
+    // of several threads completing the same call only the first one frees the slot and answers it
+    if (!__atomic_compare_exchange_n(&slot->state, &state, state & ~SLOT_IN_USE, false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_RELAXED)) {
+        return RPC_ERROR_INVALID_ARGS;
+    }
+    __atomic_sub_fetch(&session->in_flight, 1, __ATOMIC_RELAXED);
+
+    return rpc_complete(&token, complete, complete_ptr, output_buffer, output_buffer_size);
+}
+
+rpc_session_handle_t rpc_session_find(rpc_session_t *session, uint64_t transaction_id) {
+    for (size_t i = 0; i < session->window; i++) {
+        const rpc_session_slot_t *slot = &session->slots[i];
+        uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+        if ((state & SLOT_IN_USE) && slot->token.transaction_id == transaction_id) return make_handle(i, state);
+    }
+
+    return RPC_SESSION_NO_SLOT;
+}
+
+size_t rpc_session_get_in_flight(rpc_session_t *session) {
+    return __atomic_load_n(&session->in_flight, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SIMPLECBORRPC_RPC_SESSION_H
+#define SIMPLECBORRPC_RPC_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "simplecborrpc.h"
+
+// Names one deferred call: the index of its slot in the low 32 bits and the state the slot had when the call took it
+// in the high 32 bits. A handle of a call that was answered already does not match the slot once it is reused.
+typedef uint64_t rpc_session_handle_t;
+
+#define RPC_SESSION_NO_SLOT ((rpc_session_handle_t) -1)
+
+typedef struct {
+    rpc_deferred_t token;
+
+    // bit 0 is set while the slot holds a call, the bits above count the calls the slot has taken
+    uint32_t state;
+} rpc_session_slot_t;
+
+// The calls of one connection that were deferred and not answered yet, keyed by transaction id. Requests keep being
+// executed while earlier ones are outstanding and their responses go out in whatever order they complete; window
+// bounds how many can be outstanding at once.
+//
+// rpc_session_defer is called from the handlers and therefore from the thread that executes the connection's
+// requests. rpc_session_complete and rpc_session_find may be called from any thread.
+typedef struct {
+    rpc_session_slot_t *slots;
+    size_t window;
+    size_t in_flight;
+} rpc_session_t;
+
+// slots points to window entries that stay owned by the caller, window has to fit the 32 bits of a handle
+void rpc_session_init(rpc_session_t *session, rpc_session_slot_t *slots, size_t window);
+
+// rpc_defer for a handler serving session: records the call in a free slot, stores its handle in *handle and returns
+// RPC_PENDING. Once the window is full RPC_ERROR_TOO_MANY_REQUESTS is returned, so the handler answers the request
+// with that error and the client backs off. A call without an id, or with the id of a call that is still
+// outstanding, could not be matched to its response and is refused with RPC_ERROR_INVALID_REQUEST.
+rpc_error_t rpc_session_defer(rpc_session_t *session, CborEncoder *result, rpc_session_handle_t *handle);
+
+// Encodes the response of the call behind handle with rpc_complete and frees its slot for the next deferred call.
+// A handle of a call that is not outstanding, e.g. one that was completed already even if its slot has been taken by
+// another call since, is refused with RPC_ERROR_INVALID_ARGS and nothing is written.
+rpc_error_t rpc_session_complete(rpc_session_t *session, rpc_session_handle_t handle, rpc_complete_function_t complete,
+                                 void *complete_ptr, uint8_t *output_buffer, size_t *output_buffer_size);
+
+// Returns the handle of the outstanding call with transaction_id, or RPC_SESSION_NO_SLOT
+rpc_session_handle_t rpc_session_find(rpc_session_t *session, uint64_t transaction_id);
+
+size_t rpc_session_get_in_flight(rpc_session_t *session);
+
+#endif //SIMPLECBORRPC_RPC_SESSION_H
@@ -1,212 +1,1003 @@
 /* SPDX-License-Identifier: MIT */
 
+#if defined(SIMPLECBORRPC_ENABLE_STATS) && !defined(SIMPLECBORRPC_STATS_CLOCK)
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#endif
+
 #include "simplecborrpc.h"
+#include "rpc_internal.h"
 
 #define CHECK_CBOR_ENCODE(X) if (X != CborNoError) { return RPC_ENCODE_ERROR; }
 
-static rpc_error_t execute_rpc_call_internal(const rpc_function_entry_t *rpc_functions, size_t rpc_functions_count,
-                                             const uint8_t *input_buffer, size_t input_buffer_size,
-                                             uint8_t *output_buffer, size_t *output_buffer_size,
-                                             uint64_t *transaction_id, const char **error_msg,
-                                             void *user_ptr) {
-    CborParser parser;
-    CborValue outer_it;
-    CborValue inner_it, args_it;
+#define RPC_PARSER_FLAGS (CborValidateMapKeysAreUnique | CborValidateNoIndeterminateLength | CborValidateNoUndefined | CborValidateCompleteData)
 
-    size_t flags = CborValidateMapKeysAreUnique | CborValidateNoIndeterminateLength | CborValidateNoUndefined | CborValidateCompleteData;
-    if (cbor_parser_init(input_buffer, input_buffer_size, flags, &parser, &outer_it) != CborNoError)
-        return RPC_ERROR_INTERNAL_ERROR;
+typedef struct {
+    uint64_t transaction_id;
+    bool compact;
 
-    size_t handle = rpc_functions_count;
-    size_t args_count = 0;
+    // the index of the function, which keys its statistics and cached results, and the entry it resolved to
+    size_t handle;
+    const rpc_function_entry_t *function;
 
-    // process request data
-    if (!cbor_value_is_map(&outer_it)) return RPC_ERROR_INVALID_REQUEST;
+    CborValue args_it;
+    size_t args_count;
+    uint8_t argument_types[SIMPLECBORRPC_MAX_ARGUMENTS];
 
-    CborValue id_it;
-    if (cbor_value_map_find_value(&outer_it, "id", &id_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
-    if (cbor_value_is_valid(&id_it)) {
-        if (cbor_value_is_unsigned_integer(&id_it)) {
-            cbor_value_get_uint64(&id_it, transaction_id);
-        } else {
-            return RPC_ERROR_PARSE_ERROR;
+    // the args of a lazy function were the last value of the request and have not been stepped over
+    bool args_lazy;
+
+    // the raw args array, the cache key together with the handle
+    const uint8_t *args;
+    size_t args_size;
+
+    // what the walk over the args found, compared with the limits of the function once it is known
+    bool args_measured;
+    size_t args_depth;
+    size_t args_items;
+    size_t args_string_bytes;
+} rpc_request_t;
+
+#define ARGUMENT_TYPE_UNSUPPORTED 0xFF
+
+static uint8_t get_argument_type(const CborValue *it) {
+    switch (cbor_value_get_type(it)) {
+        case CborIntegerType:
+            return cbor_value_is_unsigned_integer(it) ? CBOR_TYPE_UNSIGNED_INTEGER : CBOR_TYPE_NEGATIVE_INTEGER;
+
+        case CborByteStringType:
+            return CBOR_TYPE_BYTE_STRING;
+
+        case CborTextStringType:
+            return CBOR_TYPE_TEXT_STRING;
+
+        case CborArrayType:
+            return CBOR_TYPE_ARRAY;
+
+        case CborMapType:
+            return CBOR_TYPE_MAP;
+
+        case CborSimpleType:
+            return CBOR_TYPE_SIMPLE;
+
+        case CborBooleanType:
+            return CBOR_TYPE_BOOL;
+
+        case CborNullType:
+            return CBOR_TYPE_NULL;
+
+        case CborHalfFloatType:
+            return CBOR_TYPE_HALF_FLOAT;
+
+        case CborFloatType:
+            return CBOR_TYPE_FLOAT;
+
+        case CborDoubleType:
+            return CBOR_TYPE_DOUBLE;
+
+        default:
+            return ARGUMENT_TYPE_UNSUPPORTED;
+    }
+}
+
+static bool argument_type_matches(rpc_argument_type_t expected, uint8_t actual) {
+    if (expected == actual) return true;
+
+    return expected == CBOR_TYPE_SIGNED_INTEGER &&
+           (actual == CBOR_TYPE_UNSIGNED_INTEGER || actual == CBOR_TYPE_NEGATIVE_INTEGER);
+}
+
+rpc_error_t rpc_check_argument_type(const CborValue *it, rpc_argument_type_t type) {
+    return argument_type_matches(type, get_argument_type(it)) ? RPC_OK : RPC_ERROR_INVALID_ARGS;
+}
+
+rpc_error_t rpc_get_text_string_view(const CborValue *it, const char **text, size_t *length) {
+    if (!cbor_value_is_text_string(it) || !cbor_value_is_length_known(it)) return RPC_ERROR_INVALID_ARGS;
+
+    // a definite length string is a single chunk
+    if (cbor_value_get_text_string_chunk(it, text, length, NULL) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+    return RPC_OK;
+}
+
+rpc_error_t rpc_get_byte_string_view(const CborValue *it, const uint8_t **bytes, size_t *length) {
+    if (!cbor_value_is_byte_string(it) || !cbor_value_is_length_known(it)) return RPC_ERROR_INVALID_ARGS;
+
+    if (cbor_value_get_byte_string_chunk(it, bytes, length, NULL) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+    return RPC_OK;
+}
+
+// the index of name in the generated table, or (size_t) -1
+static size_t table_lookup(const rpc_dispatcher_t *dispatcher, const char *name, size_t length) {
+    // no key is longer than the salts
+    if (length > dispatcher->salt_size) return -1;
+
+    // the generator checks that the sums can not overflow, so the modulo is only taken once
+    uint32_t sum1 = length, sum2 = length;
+    for (size_t i = 0; i < length; i++) {
+        const uint8_t c = (uint8_t) name[i];
+        sum1 += (uint32_t) dispatcher->salts[2 * i] * c;
+        sum2 += (uint32_t) dispatcher->salts[2 * i + 1] * c;
+    }
+
+    size_t index = dispatcher->graph[sum1 % dispatcher->graph_size] + dispatcher->graph[sum2 % dispatcher->graph_size];
+    index %= dispatcher->graph_size;
+
+    if (index < dispatcher->function_count && dispatcher->key_lengths[index] == length &&
+        memcmp(name, dispatcher->functions[index].name, length) == 0) {
+        return index;
+    }
+
+    return -1;
+}
+
+// marks the slots of unregistered functions that lookups of other functions still have to probe past
+static const rpc_function_entry_t registry_removed = {.name = NULL};
+
+// FNV-1a
+static uint32_t registry_hash(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// key is null terminated, name is not
+static bool registry_name_equals(const char *key, const char *name, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (key[i] != name[i] || key[i] == '\0') return false;
+    }
+
+    return key[length] == '\0';
+}
+
+// Returns the registered function called name and stores its slot, NULL if there is none. Every slot is loaded once:
+// the writer publishes a function only after its hash, so a function that is seen also has its hash in place.
+static const rpc_function_entry_t *registry_find(const rpc_registry_t *registry, const char *name, size_t length,
+                                                 size_t *slot) {
+    if (registry == NULL || registry->capacity == 0) return NULL;
+
+    const uint32_t hash = registry_hash(name, length);
+    const size_t mask = registry->capacity - 1;
+
+    for (size_t i = 0; i < registry->capacity; i++) {
+        const rpc_registry_slot_t *candidate = &registry->slots[(hash + i) & mask];
+        const rpc_function_entry_t *function = __atomic_load_n(&candidate->function, __ATOMIC_ACQUIRE);
+
+        if (function == NULL) return NULL;
+        if (function != &registry_removed && __atomic_load_n(&candidate->hash, __ATOMIC_RELAXED) == hash &&
+            registry_name_equals(function->name, name, length)) {
+            *slot = (hash + i) & mask;
+            return function;
         }
-    } else {
-        *transaction_id = 0;
     }
 
-    if (cbor_value_enter_container(&outer_it, &inner_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+    return NULL;
+}
 
-    while (!cbor_value_at_end(&inner_it)) {
-        if (!cbor_value_is_text_string(&inner_it)) return RPC_ERROR_INVALID_REQUEST;
+// Resolves name to a function of the table or the registry and its index. The entry is returned instead of being
+// looked up again by index, a registered function may be replaced in between.
+static const rpc_function_entry_t *find_function(const rpc_dispatcher_t *dispatcher, const char *name, size_t length,
+                                                 size_t *index) {
+    size_t slot = table_lookup(dispatcher, name, length);
+    if (slot != (size_t) -1) {
+        *index = slot;
+        return &dispatcher->functions[slot];
+    }
 
-        bool result = false;
+    const rpc_function_entry_t *function = registry_find(dispatcher->registry, name, length, &slot);
+    if (function != NULL) *index = dispatcher->function_count + slot;
+    return function;
+}
 
-        cbor_value_text_string_equals(&inner_it, "id", &result);
-        if (result) {
-            if (cbor_value_advance(&inner_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+static const rpc_function_entry_t *get_function(const rpc_dispatcher_t *dispatcher, size_t index) {
+    if (index < dispatcher->function_count) return &dispatcher->functions[index];
 
-            // id was already collected earlier
-            if (cbor_value_advance(&inner_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
-            continue;
+    const rpc_registry_t *registry = dispatcher->registry;
+    index -= dispatcher->function_count;
+    if (registry == NULL || index >= registry->capacity) return NULL;
+
+    const rpc_function_entry_t *function = __atomic_load_n(&registry->slots[index].function, __ATOMIC_ACQUIRE);
+    return function == &registry_removed ? NULL : function;
+}
+
+size_t rpc_lookup_index_by_name(const rpc_dispatcher_t *dispatcher, const char *name, size_t length) {
+    size_t index;
+    return find_function(dispatcher, name, length, &index) != NULL ? index : (size_t) -1;
+}
+
+size_t rpc_lookup_index_by_key(const rpc_dispatcher_t *dispatcher, const char *key) {
+    return rpc_lookup_index_by_name(dispatcher, key, strlen(key));
+}
+
+const char *rpc_lookup_key_by_index(const rpc_dispatcher_t *dispatcher, size_t index) {
+    const rpc_function_entry_t *function = get_function(dispatcher, index);
+    return function != NULL ? function->name : NULL;
+}
+
+size_t rpc_get_key_count(const rpc_dispatcher_t *dispatcher) {
+    return dispatcher->function_count;
+}
+
+rpc_registry_status_t
+rpc_registry_init(const rpc_dispatcher_t *dispatcher, rpc_registry_slot_t *slots, size_t capacity) {
+    rpc_registry_t *registry = dispatcher->registry;
+    if (registry == NULL || capacity == 0 || (capacity & (capacity - 1)) != 0) return RPC_REGISTRY_INVALID;
+
+    for (size_t i = 0; i < capacity; i++) {
+        slots[i].function = NULL;
+        slots[i].hash = 0;
+    }
+
+    registry->slots = slots;
+    registry->capacity = capacity;
+    return RPC_REGISTRY_OK;
+}
+
+rpc_registry_status_t rpc_register_function(const rpc_dispatcher_t *dispatcher, const rpc_function_entry_t *function) {
+    rpc_registry_t *registry = dispatcher->registry;
+    size_t index;
+
+    if (registry == NULL || registry->capacity == 0 || function->name == NULL) return RPC_REGISTRY_INVALID;
+
+    const size_t length = strlen(function->name);
+    if (find_function(dispatcher, function->name, length, &index) != NULL) return RPC_REGISTRY_NAME_TAKEN;
+
+    // the name is not registered, so the first free slot of the probe sequence can be taken
+    const uint32_t hash = registry_hash(function->name, length);
+    const size_t mask = registry->capacity - 1;
+
+    for (size_t i = 0; i < registry->capacity; i++) {
+        rpc_registry_slot_t *slot = &registry->slots[(hash + i) & mask];
+        const rpc_function_entry_t *current = __atomic_load_n(&slot->function, __ATOMIC_RELAXED);
+        if (current != NULL && current != &registry_removed) continue;
+
+        __atomic_store_n(&slot->hash, hash, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->function, function, __ATOMIC_RELEASE);
+        return RPC_REGISTRY_OK;
+    }
+
+    return RPC_REGISTRY_FULL;
+}
+
+// Frees the removed slots that no registered function is probed past, so that lookups that miss stop at the end of
+// the functions that are left instead of walking over every slot ever used. Lookups running meanwhile only stop
+// earlier on slots they would not find their function behind. Two rounds backwards over the slots, the first one
+// only picks up how far the functions at the start of the array reach back past its end.
+static void registry_sweep(rpc_registry_t *registry) {
+    const size_t mask = registry->capacity - 1;
+    size_t reach = 0;    // how many slots before the current one are probed past to find a later function
+
+    for (size_t i = 2 * registry->capacity; i > 0; i--) {
+        rpc_registry_slot_t *slot = &registry->slots[(i - 1) & mask];
+        const bool needed = reach > 0;
+        if (reach > 0) reach--;
+
+        const rpc_function_entry_t *function = __atomic_load_n(&slot->function, __ATOMIC_RELAXED);
+        if (function == NULL) {
+            reach = 0;
+        } else if (function == &registry_removed) {
+            if (!needed && i <= registry->capacity) __atomic_store_n(&slot->function, NULL, __ATOMIC_RELEASE);
+        } else {
+            const size_t displacement = ((i - 1) - __atomic_load_n(&slot->hash, __ATOMIC_RELAXED)) & mask;
+            if (displacement > reach) reach = displacement;
         }
+    }
+}
 
-        cbor_value_text_string_equals(&inner_it, "func", &result);
-        if (result) {
-            if (cbor_value_advance(&inner_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+rpc_registry_status_t rpc_unregister_function(const rpc_dispatcher_t *dispatcher, const char *name) {
+    size_t slot;
+    if (registry_find(dispatcher->registry, name, strlen(name), &slot) == NULL) return RPC_REGISTRY_NOT_FOUND;
 
-            int32_t function_index;
-            if (cbor_value_is_text_string(&inner_it)) {
-                char tmp[33];
-                size_t key_size = 33;
-                if (cbor_value_copy_text_string(&inner_it, tmp, &key_size, NULL) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+    __atomic_store_n(&dispatcher->registry->slots[slot].function, &registry_removed, __ATOMIC_RELEASE);
+    registry_sweep(dispatcher->registry);
 
-                if (key_size == 33) return RPC_ERROR_INVALID_REQUEST; // max size is 32 chars + null terminator
+    // the next function in this slot gets the same index
+    rpc_cache_invalidate(dispatcher, dispatcher->function_count + slot);
+    return RPC_REGISTRY_OK;
+}
 
-                function_index = rpc_lookup_index_by_key(tmp);
+#ifdef SIMPLECBORRPC_ENABLE_STATS
+#ifndef SIMPLECBORRPC_STATS_CLOCK
+static uint64_t stats_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
 
-                if (function_index < 0) return RPC_ERROR_METHOD_NOT_FOUND;
-                else handle = function_index;
+#define SIMPLECBORRPC_STATS_CLOCK() stats_clock()
+#endif
 
-            } else if (cbor_value_is_integer(&inner_it)) {
-                // access by index
-                cbor_value_get_int(&inner_it, (int *)&function_index);
+const rpc_error_t rpc_stats_error_codes[RPC_STATS_ERROR_KINDS - 1] = {
+        RPC_ERROR_PARSER_FAILED, RPC_ERROR_UNEXPECTED_KEY_IN_REQUEST, RPC_ERROR_TOO_MANY_REQUESTS,
+        RPC_ERROR_PARSE_ERROR, RPC_ERROR_INVALID_REQUEST, RPC_ERROR_METHOD_NOT_FOUND, RPC_ERROR_INVALID_ARGS,
+        RPC_ERROR_INTERNAL_ERROR, RPC_ERROR_ENCODE_ERROR, RPC_ERROR_LIMIT_EXCEEDED
+};
 
-                if (rpc_lookup_key_by_index(function_index) == NULL) return RPC_ERROR_METHOD_NOT_FOUND;
+static void stats_add_latency(uint32_t *histogram, uint64_t duration) {
+    size_t bucket = 0;
+    while (duration > 1 && bucket < SIMPLECBORRPC_STATS_BUCKETS - 1) {
+        duration >>= 1;
+        bucket++;
+    }
 
-                handle = function_index;
-            } else {
-                return RPC_ERROR_INVALID_REQUEST;
-            }
+    __atomic_add_fetch(&histogram[bucket], 1, __ATOMIC_RELAXED);
+}
+
+// records the phase that started at *timestamp and starts the next one
+static void stats_phase(const rpc_dispatcher_t *dispatcher, rpc_stats_phase_t phase, uint64_t *timestamp) {
+    uint64_t now = SIMPLECBORRPC_STATS_CLOCK();
+    stats_add_latency(dispatcher->stats->phases[phase], now - *timestamp);
+    *timestamp = now;
+}
 
-            if (cbor_value_advance(&inner_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+static void stats_error(const rpc_dispatcher_t *dispatcher, rpc_error_t err) {
+    if (err == RPC_OK || err == RPC_PENDING) return;
 
+    size_t kind = 0;
+    while (kind < RPC_STATS_ERROR_KINDS - 1 && rpc_stats_error_codes[kind] != err) kind++;
+
+    __atomic_add_fetch(&dispatcher->stats->errors[kind], 1, __ATOMIC_RELAXED);
+}
+
+static void stats_bytes(const rpc_dispatcher_t *dispatcher, size_t request_size, size_t response_size) {
+    __atomic_add_fetch(&dispatcher->stats->request_bytes, request_size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&dispatcher->stats->response_bytes, response_size, __ATOMIC_RELAXED);
+}
+
+static void stats_function(const rpc_dispatcher_t *dispatcher, size_t index, rpc_error_t result, uint64_t *timestamp) {
+    uint64_t start = *timestamp;
+
+    stats_phase(dispatcher, RPC_STATS_HANDLER, timestamp);
+
+    // registered functions only count towards the phases, the table has no counters for them
+    if (index >= dispatcher->function_count) return;
+
+    rpc_function_stats_t *function = &dispatcher->stats->functions[index];
+    stats_add_latency(function->latency, *timestamp - start);
+
+    __atomic_add_fetch(&function->calls, 1, __ATOMIC_RELAXED);
+    if (result != RPC_OK && result != RPC_PENDING) __atomic_add_fetch(&function->errors, 1, __ATOMIC_RELAXED);
+}
+
+#define STATS_TIMESTAMP(X) uint64_t X = SIMPLECBORRPC_STATS_CLOCK()
+#define STATS_PHASE(dispatcher, phase, timestamp) stats_phase(dispatcher, phase, &timestamp)
+#define STATS_ERROR(dispatcher, err) stats_error(dispatcher, err)
+#define STATS_BYTES(dispatcher, request_size, response_size) stats_bytes(dispatcher, request_size, response_size)
+#define STATS_FUNCTION(dispatcher, index, result, timestamp) stats_function(dispatcher, index, result, &timestamp)
+#else
+#define STATS_TIMESTAMP(X)
+#define STATS_PHASE(dispatcher, phase, timestamp)
+#define STATS_ERROR(dispatcher, err)
+#define STATS_BYTES(dispatcher, request_size, response_size)
+#define STATS_FUNCTION(dispatcher, index, result, timestamp)
+#endif
+
+// Steps over the arguments at it, recording the type of every argument and measuring them against limits on the
+// way. Instead of recursing like cbor_value_advance the walk keeps one iterator per level in a fixed size array, and
+// container lengths are checked before they are entered, so a hostile request is given up on in bounded time and
+// stack. Returns with it at the end of the args array.
+static rpc_error_t walk_arguments(CborValue *it, const rpc_limits_t *limits, rpc_request_t *request) {
+    CborValue parents[SIMPLECBORRPC_MAX_DEPTH];
+    const size_t max_depth = limits->depth < SIMPLECBORRPC_MAX_DEPTH ? limits->depth : SIMPLECBORRPC_MAX_DEPTH;
+    size_t depth = 0;
+    size_t i = 0;
+
+    request->args_measured = true;
+
+    for (;;) {
+        if (cbor_value_at_end(it)) {
+            if (depth == 0) return RPC_OK;
+
+            depth--;
+            if (cbor_value_leave_container(&parents[depth], it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+            *it = parents[depth];
             continue;
         }
 
-        cbor_value_text_string_equals(&inner_it, "args", &result);
-        if (result) {
-            if (cbor_value_advance(&inner_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+        if (depth == 0) {
+            if (i < SIMPLECBORRPC_MAX_ARGUMENTS) request->argument_types[i] = get_argument_type(it);
+            i++;
+        }
+
+        if (request->args_items == limits->items) return RPC_ERROR_LIMIT_EXCEEDED;
+        request->args_items++;
 
-            if (!cbor_value_is_array(&inner_it)) return RPC_ERROR_INVALID_REQUEST;
+        if (cbor_value_is_container(it)) {
+            if (depth == max_depth) return RPC_ERROR_LIMIT_EXCEEDED;
 
-            if (cbor_value_get_array_length(&inner_it, &args_count) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+            // the items of a definite length container are known before walking them
+            size_t length;
+            if (cbor_value_is_length_known(it)) {
+                if (cbor_value_is_array(it)) {
+                    if (cbor_value_get_array_length(it, &length) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+                } else {
+                    if (cbor_value_get_map_length(it, &length) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+                    if (length > SIZE_MAX / 2) return RPC_ERROR_LIMIT_EXCEEDED;
+                    length *= 2;
+                }
 
-            if (cbor_value_enter_container(&inner_it, &args_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+                if (length > limits->items - request->args_items) return RPC_ERROR_LIMIT_EXCEEDED;
+            }
 
-            if (cbor_value_advance(&inner_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+            parents[depth] = *it;
+            if (cbor_value_enter_container(&parents[depth], it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
 
+            depth++;
+            if (depth > request->args_depth) request->args_depth = depth;
             continue;
         }
 
-        return RPC_ERROR_UNEXPECTED_KEY_IN_REQUEST;
+        if (cbor_value_is_text_string(it) || cbor_value_is_byte_string(it)) {
+            size_t length;
+            if (cbor_value_get_string_length(it, &length) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+            if (length > limits->string_bytes - request->args_string_bytes) return RPC_ERROR_LIMIT_EXCEEDED;
+
+            request->args_string_bytes += length;
+        }
+
+        // not a container, nothing to recurse into
+        if (cbor_value_advance(it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
     }
+}
 
-    // validate arguments
-    if (args_count != rpc_functions[handle].number_of_arguments) return RPC_ERROR_INVALID_ARGS;
+// Walks the request map exactly once, collecting the id, the function handle, the args iterator and the type of
+// every argument. Errors that still leave the map walkable are deferred until the end of the walk so that the id
+// is available for the error response regardless of key order.
+static rpc_error_t decode_request(const rpc_dispatcher_t *dispatcher, CborValue *request_it, rpc_request_t *request) {
+    CborValue map_it;
+    rpc_error_t deferred_error = RPC_OK;
+
+    request->transaction_id = 0;
+    request->compact = false;
+    request->handle = dispatcher->function_count;
+    request->function = NULL;
+    request->args_count = 0;
+    request->args_lazy = false;
+    request->args = NULL;
+    request->args_size = 0;
+    request->args_measured = true;
+    request->args_depth = 0;
+    request->args_items = 0;
+    request->args_string_bytes = 0;
+
+    if (!cbor_value_is_map(request_it)) return RPC_ERROR_INVALID_REQUEST;
+
+    // pairs still to come, SIZE_MAX for a map of unknown length
+    size_t pairs_left;
+    if (cbor_value_get_map_length(request_it, &pairs_left) != CborNoError) pairs_left = SIZE_MAX;
+
+    if (cbor_value_enter_container(request_it, &map_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+
+    bool first_key = true;
+    while (!request->args_lazy && !cbor_value_at_end(&map_it)) {
+        int key = RPC_KEY_UNKNOWN;
+        bool compact_key = false;
+        if (pairs_left != SIZE_MAX) pairs_left--;
+
+        if (cbor_value_is_unsigned_integer(&map_it)) {
+            uint64_t key_value;
+            cbor_value_get_uint64(&map_it, &key_value);
+
+            compact_key = true;
+            if (key_value <= RPC_KEY_ARGS) key = (int) key_value;
+
+        } else if (cbor_value_is_text_string(&map_it) && cbor_value_is_length_known(&map_it)) {
+            const char *key_text;
+            size_t key_size;
+            if (cbor_value_get_text_string_chunk(&map_it, &key_text, &key_size, NULL) != CborNoError)
+                return RPC_ERROR_PARSER_FAILED;
+
+            for (int i = RPC_KEY_ID; i <= RPC_KEY_ARGS; i++) {
+                if (key_size == RPC_TEXT_KEY_NAME_LENGTH(i) && memcmp(key_text, RPC_TEXT_KEY_NAME(i), key_size) == 0) {
+                    key = i;
+                }
+            }
 
-    const size_t number_of_arguments = rpc_functions[handle].number_of_arguments;
-    if (number_of_arguments > 0) {
-        const rpc_argument_type_t *argument_types = rpc_functions[handle].argument_types;
-        CborValue args_it_validation;
-        memcpy(&args_it_validation, &args_it, sizeof(CborValue));
+        } else if (deferred_error == RPC_OK) {
+            deferred_error = RPC_ERROR_INVALID_REQUEST;
+        }
 
-        size_t i = 0;
-        while (!cbor_value_at_end(&args_it_validation)) {
-            switch (argument_types[i]) {
-                case CBOR_TYPE_NULL:
-                    if (!cbor_value_is_null(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_BOOL:
-                    if (!cbor_value_is_boolean(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_SIMPLE:
-                    if (!cbor_value_is_simple_type(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_SIGNED_INTEGER:
-                    if (!cbor_value_is_integer(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_UNSIGNED_INTEGER:
-                    if (!cbor_value_is_unsigned_integer(&args_it_validation))
-                        return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_NEGATIVE_INTEGER:
-                    if (!cbor_value_is_negative_integer(&args_it_validation))
-                        return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_HALF_FLOAT:
-                    if (!cbor_value_is_half_float(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_FLOAT:
-                    if (!cbor_value_is_float(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_DOUBLE:
-                    if (!cbor_value_is_double(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_TEXT_STRING:
-                    if (!cbor_value_is_text_string(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_BYTE_STRING:
-                    if (!cbor_value_is_byte_string(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_ARRAY:
-                    if (!cbor_value_is_array(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                case CBOR_TYPE_MAP:
-                    if (!cbor_value_is_map(&args_it_validation)) return RPC_ERROR_INVALID_ARGS;
-                    break;
-
-                default:
-                    return RPC_ERROR_INVALID_ARGS;
+        // the first key selects text or compact keys for the request and its response, the two can not be mixed
+        if (first_key) {
+            request->compact = compact_key;
+            first_key = false;
+        } else if (compact_key != request->compact && deferred_error == RPC_OK) {
+            deferred_error = RPC_ERROR_INVALID_REQUEST;
+        }
+
+        if (cbor_value_advance(&map_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+
+        switch (key) {
+            case RPC_KEY_ID:
+                if (!cbor_value_is_unsigned_integer(&map_it)) {
+                    request->transaction_id = 0;
+                    return RPC_ERROR_PARSE_ERROR;
+                }
+
+                cbor_value_get_uint64(&map_it, &request->transaction_id);
+                break;
+
+            case RPC_KEY_FUNC: {
+                int32_t function_index;
+
+                if (cbor_value_is_text_string(&map_it) && cbor_value_is_length_known(&map_it)) {
+                    // the name is matched where it sits in the request buffer
+                    const char *name;
+                    size_t name_size;
+                    if (cbor_value_get_text_string_chunk(&map_it, &name, &name_size, NULL) != CborNoError)
+                        return RPC_ERROR_PARSER_FAILED;
+
+                    request->function = find_function(dispatcher, name, name_size, &request->handle);
+                    if (request->function == NULL && deferred_error == RPC_OK)
+                        deferred_error = RPC_ERROR_METHOD_NOT_FOUND;
+
+                } else if (cbor_value_is_integer(&map_it)) {
+                    // access by index
+                    cbor_value_get_int(&map_it, (int *)&function_index);
+
+                    request->function = get_function(dispatcher, (size_t) function_index);
+                    if (request->function == NULL) {
+                        if (deferred_error == RPC_OK) deferred_error = RPC_ERROR_METHOD_NOT_FOUND;
+                    } else {
+                        request->handle = function_index;
+                    }
+
+                } else if (deferred_error == RPC_OK) {
+                    deferred_error = RPC_ERROR_INVALID_REQUEST;
+                }
+                break;
             }
 
-            if (cbor_value_advance(&args_it_validation) != CborNoError) return RPC_ERROR_PARSER_FAILED;
-            i++;
+            case RPC_KEY_ARGS: {
+                if (!cbor_value_is_array(&map_it)) {
+                    if (deferred_error == RPC_OK) deferred_error = RPC_ERROR_INVALID_REQUEST;
+                    if (cbor_value_advance(&map_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+                    continue;
+                }
+
+                if (cbor_value_get_array_length(&map_it, &request->args_count) != CborNoError)
+                    return RPC_ERROR_PARSER_FAILED;
+
+                const uint8_t *args_start = cbor_value_get_next_byte(&map_it);
+
+                if (cbor_value_enter_container(&map_it, &request->args_it) != CborNoError)
+                    return RPC_ERROR_PARSER_FAILED;
+
+                // nothing has to be reached behind the args of a lazy function when they come last, the handler is
+                // the first to walk them
+                if (pairs_left == 0 && request->function != NULL && request->function->lazy &&
+                    request->function->limits == NULL) {
+                    request->args_lazy = true;
+                    continue;
+                }
+
+                // args in front of func are walked within the limits of the dispatcher, which has none unless every
+                // function has some; validate_request checks the limits of the function once it is known
+                const rpc_limits_t *limits = request->function != NULL ? request->function->limits : dispatcher->limits;
+
+                // record the argument types while stepping over the args, validation happens once the handle is known
+                CborValue arg_it = request->args_it;
+                if (limits != NULL) {
+                    rpc_error_t walk_result = walk_arguments(&arg_it, limits, request);
+                    if (walk_result != RPC_OK) return walk_result;
+                } else {
+                    request->args_measured = false;
+
+                    size_t i = 0;
+                    while (!cbor_value_at_end(&arg_it)) {
+                        if (i < SIMPLECBORRPC_MAX_ARGUMENTS) request->argument_types[i] = get_argument_type(&arg_it);
+                        i++;
+
+                        if (cbor_value_advance(&arg_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+                    }
+                }
+
+                // leaving the container steps map_it over the args value
+                if (cbor_value_leave_container(&map_it, &arg_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+
+                request->args = args_start;
+                request->args_size = (size_t) (cbor_value_get_next_byte(&map_it) - args_start);
+                continue;
+            }
+
+            default:
+                if (deferred_error == RPC_OK) deferred_error = RPC_ERROR_UNEXPECTED_KEY_IN_REQUEST;
+                break;
         }
+
+        if (cbor_value_advance(&map_it) != CborNoError) return RPC_ERROR_PARSER_FAILED;
     }
 
-    // execute rpc function
-    size_t result_key_count = 1;
-    if (*transaction_id != 0) {
-        result_key_count = 2;
+    // request_it stays at the start of a request whose args were not stepped over, batches step over it afterwards
+    if (!request->args_lazy && cbor_value_leave_container(request_it, &map_it) != CborNoError) {
+        return RPC_ERROR_PARSER_FAILED;
     }
 
-    CborEncoder response_encoder, map_encoder;
+    if (deferred_error != RPC_OK) return deferred_error;
+    if (request->function == NULL) return RPC_ERROR_INVALID_REQUEST;
+
+    return RPC_OK;
+}
 
-    cbor_encoder_init(&response_encoder, output_buffer, *output_buffer_size, 0);
-    cbor_encoder_create_map(&response_encoder, &map_encoder, result_key_count);
+// checks the arguments of a decoded request against the types recorded during the walk
+static rpc_error_t validate_request(rpc_request_t *request) {
+    const rpc_function_entry_t *function = request->function;
+    const rpc_limits_t *limits = function->limits;
 
-    if (*transaction_id != 0) {
-        cbor_encode_text_stringz(&map_encoder, "id");
-        cbor_encode_uint(&map_encoder, *transaction_id);
+    if (limits != NULL && !request->args_measured) {
+        // the args came before func on a dispatcher without limits, they are walked once more within the function's
+        CborValue arg_it = request->args_it;
+        rpc_error_t walk_result = walk_arguments(&arg_it, limits, request);
+        if (walk_result != RPC_OK) return walk_result;
     }
 
-    cbor_encode_text_stringz(&map_encoder, "res");
+    if (limits != NULL && (request->args_depth > limits->depth || request->args_items > limits->items ||
+                           request->args_string_bytes > limits->string_bytes)) {
+        return RPC_ERROR_LIMIT_EXCEEDED;
+    }
 
-    rpc_error_t rpc_result = rpc_functions[handle].function_ptr(&args_it, &map_encoder, error_msg,
-                                                                user_ptr);
+    if (request->args_count != function->number_of_arguments) return RPC_ERROR_INVALID_ARGS;
+    if (request->args_lazy) return RPC_OK;
+    if (function->number_of_arguments > SIMPLECBORRPC_MAX_ARGUMENTS) return RPC_ERROR_INVALID_ARGS;
 
-    cbor_encoder_close_container(&response_encoder, &map_encoder);
-    if (cbor_encoder_get_extra_bytes_needed(&response_encoder) != 0) {
-        return RPC_ERROR_ENCODE_ERROR;
+    for (size_t i = 0; i < function->number_of_arguments; i++) {
+        if (!argument_type_matches(function->argument_types[i], request->argument_types[i]))
+            return RPC_ERROR_INVALID_ARGS;
+    }
+
+    return RPC_OK;
+}
+
+typedef struct {
+    uint8_t *buffer;
+    size_t size;
+    size_t used;
+    size_t flushed;
+    bool failed;
+
+    rpc_flush_function_t flush;
+    void *flush_ptr;
+} rpc_stream_t;
+
+static bool stream_flush(rpc_stream_t *stream) {
+    if (stream->failed) return false;
+    if (stream->used == 0) return true;
+
+    if (!stream->flush(stream->buffer, stream->used, stream->flush_ptr)) {
+        stream->failed = true;
+        return false;
+    }
+
+    stream->flushed += stream->used;
+    stream->used = 0;
+    return true;
+}
+
+static CborError stream_write(void *token, const void *data, size_t len, CborEncoderAppendType append_type) {
+    rpc_stream_t *stream = (rpc_stream_t *) token;
+    const uint8_t *bytes = (const uint8_t *) data;
+
+    while (len > 0) {
+        if (stream->used == stream->size && !stream_flush(stream)) return CborErrorIO;
+
+        size_t count = stream->size - stream->used;
+        if (count > len) count = len;
+
+        memcpy(stream->buffer + stream->used, bytes, count);
+        stream->used += count;
+        bytes += count;
+        len -= count;
+    }
+
+    return CborNoError;
+}
+
+// Response output, either a flat buffer or a stream. The response framing is copied in from pre-encoded templates,
+// only the result produced by a handler goes through a CborEncoder.
+typedef struct {
+    uint8_t *buffer;
+    size_t size;
+    size_t used;
+    bool overflow;
+
+    rpc_stream_t *stream;
+} rpc_output_t;
+
+static void output_write(rpc_output_t *output, const uint8_t *data, size_t size) {
+    if (output->stream != NULL) {
+        stream_write(output->stream, data, size, CborEncoderAppendCborData);
+    } else if (output->overflow || size > output->size - output->used) {
+        output->overflow = true;
     } else {
-        *output_buffer_size = cbor_encoder_get_buffer_size(&response_encoder, output_buffer);
-        return rpc_result;
+        memcpy(output->buffer + output->used, data, size);
+        output->used += size;
     }
 }
 
+static void output_begin_payload(rpc_output_t *output, CborEncoder *encoder) {
+    if (output->stream != NULL) {
+        cbor_encoder_init_writer(encoder, stream_write, output->stream);
+    } else {
+        // after an overflow the handler still runs, but nothing it encodes is kept
+        size_t available = output->overflow ? 0 : output->size - output->used;
+        cbor_encoder_init(encoder, output->buffer + output->used, available, 0);
+    }
+}
+
+static void output_end_payload(rpc_output_t *output, CborEncoder *encoder) {
+    if (output->stream != NULL || output->overflow) return;
+
+    if (cbor_encoder_get_extra_bytes_needed(encoder) != 0) output->overflow = true;
+    else output->used += cbor_encoder_get_buffer_size(encoder, output->buffer + output->used);
+}
+
+// What a handler is running for. The encoder handed to the handler is the first member, so rpc_defer can find the call
+// from it.
+typedef struct {
+    CborEncoder encoder;
+
+    uint64_t transaction_id;
+    bool compact;
+
+    rpc_output_t *output;
+    bool deferrable;
+    bool deferred;
+
+    // set when the result may stay in caller memory, see execute_rpc_call_iov
+    rpc_iovec_t *reference;
+} rpc_call_t;
+
+rpc_error_t rpc_defer(CborEncoder *result, rpc_deferred_t *token) {
+    rpc_call_t *call = (rpc_call_t *) result;
+
+    // part of a streamed response may already be on the wire
+    if (!call->deferrable || (call->output->stream != NULL && call->output->stream->flushed != 0)) {
+        return RPC_ERROR_INTERNAL_ERROR;
+    }
+
+    token->transaction_id = call->transaction_id;
+    token->compact = call->compact;
+    call->deferred = true;
+    return RPC_PENDING;
+}
+
+size_t rpc_encode_head(uint8_t *head, uint8_t major_type, uint64_t value) {
+    major_type <<= 5;
+
+    if (value < 24) {
+        head[0] = major_type | (uint8_t) value;
+        return 1;
+    }
+
+    size_t size = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFF ? 4 : 8;
+    head[0] = major_type | (size == 1 ? 24 : size == 2 ? 25 : size == 4 ? 26 : 27);
+    for (size_t i = size; i > 0; i--) {
+        head[i] = (uint8_t) value;
+        value >>= 8;
+    }
+
+    return size + 1;
+}
+
+CborError rpc_encode_byte_string_reference(CborEncoder *result, const uint8_t *data, size_t size) {
+    rpc_call_t *call = (rpc_call_t *) result;
+    rpc_output_t *output = call->output;
+
+    if (call->reference == NULL) return cbor_encode_byte_string(result, data, size);
+
+    // the result has to be this byte string alone, the response ends right behind it
+    if (call->reference->data != NULL || (!output->overflow &&
+                                          cbor_encoder_get_buffer_size(result, output->buffer + output->used) != 0)) {
+        return CborErrorTooManyItems;
+    }
+
+    uint8_t head[9];
+    output_write(output, head, rpc_encode_head(head, 2, size));
+    if (output->overflow) return CborErrorOutOfMemory;
+
+    call->reference->data = data;
+    call->reference->size = size;
+
+    // anything encoded after the reference does not fit and fails the call
+    cbor_encoder_init(result, output->buffer + output->used, 0, 0);
+    return CborNoError;
+}
+
+CborError rpc_encode_preencoded(CborEncoder *result, const uint8_t *data, size_t size) {
+    rpc_call_t *call = (rpc_call_t *) result;
+    rpc_output_t *output = call->output;
+
+    if (output->stream == NULL && !output->overflow &&
+        cbor_encoder_get_buffer_size(result, output->buffer + output->used) != 0) {
+        return CborErrorTooManyItems;
+    }
+
+    output_write(output, data, size);
+    if (output->overflow) return CborErrorOutOfMemory;
+    if (output->stream != NULL && output->stream->failed) return CborErrorIO;
+
+    if (output->stream == NULL) cbor_encoder_init(result, output->buffer + output->used, 0, 0);
+    return CborNoError;
+}
+
+// pre-encoded text keys, only the id, the error code and the message are encoded per call
+const char *const rpc_text_keys[RPC_KEY_COUNT] = {
+        "\x62" "id", "\x64" "func", "\x64" "args", "\x63" "res", "\x63" "err", "\x61" "c", "\x63" "msg"
+};
+
+// largest response header: {"id": <uint64>, "err": {"c": <code>, "msg": <text header>
+#define RESPONSE_HEADER_MAX_SIZE (1 + 3 + 9 + 4 + 1 + 2 + 9 + 4 + 9)
+
+static size_t append_key(uint8_t *header, size_t size, bool compact, rpc_key_t key) {
+    if (compact) {
+        header[size] = (uint8_t) key;
+        return size + 1;
+    }
+
+    memcpy(header + size, rpc_text_keys[key], RPC_TEXT_KEY_SIZE(key));
+    return size + RPC_TEXT_KEY_SIZE(key);
+}
+
+static size_t encode_response_header(uint8_t *header, uint64_t transaction_id, bool compact, rpc_key_t key) {
+    size_t size = rpc_encode_head(header, 5, transaction_id != 0 ? 2 : 1);
+
+    if (transaction_id != 0) {
+        size = append_key(header, size, compact, RPC_KEY_ID);
+        size += rpc_encode_head(header + size, 0, transaction_id);
+    }
+
+    return append_key(header, size, compact, key);
+}
+
+static void cache_lock(rpc_cache_t *cache) {
+    while (__atomic_test_and_set(&cache->lock, __ATOMIC_ACQUIRE));
+}
+
+static void cache_unlock(rpc_cache_t *cache) {
+    __atomic_clear(&cache->lock, __ATOMIC_RELEASE);
+}
+
+// FNV-1a over the function index and the args
+static size_t cache_slot(const rpc_cache_t *cache, size_t handle, const uint8_t *args, size_t args_size) {
+    uint32_t hash = 2166136261u ^ (uint32_t) handle;
+    hash *= 16777619u;
+
+    for (size_t i = 0; i < args_size; i++) {
+        hash ^= args[i];
+        hash *= 16777619u;
+    }
+
+    return hash % cache->slot_count;
+}
+
+// copies the cached result for handle and args to output, returns false on a miss
+static bool cache_lookup(rpc_cache_t *cache, size_t handle, const uint8_t *args, size_t args_size,
+                         rpc_output_t *output) {
+    size_t index = cache_slot(cache, handle, args, args_size);
+    const rpc_cache_slot_t *slot = &cache->slots[index];
+    const uint8_t *memory = cache->memory + index * cache->slot_size;
+    bool hit = false;
+
+    cache_lock(cache);
+    if (slot->function == handle + 1 && slot->args_size == args_size &&
+        (args_size == 0 || memcmp(memory, args, args_size) == 0)) {
+        output_write(output, memory + args_size, slot->result_size);
+        hit = true;
+    }
+    cache_unlock(cache);
+
+    return hit;
+}
+
+// the generation is read before the handler runs, invalidating the cache concurrently has to win over the result
+static size_t cache_generation(rpc_cache_t *cache) {
+    return __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+}
+
+// stores result unless the cache was invalidated since generation was read, it may depend on what changed
+static void cache_store(rpc_cache_t *cache, size_t generation, size_t handle, const uint8_t *args, size_t args_size,
+                        const uint8_t *result, size_t result_size) {
+    if (args_size > cache->slot_size || result_size > cache->slot_size - args_size) return;
+
+    size_t index = cache_slot(cache, handle, args, args_size);
+    rpc_cache_slot_t *slot = &cache->slots[index];
+    uint8_t *memory = cache->memory + index * cache->slot_size;
+
+    cache_lock(cache);
+    if (cache->generation != generation) {
+        cache_unlock(cache);
+        return;
+    }
+
+    if (args_size != 0) memcpy(memory, args, args_size);
+    memcpy(memory + args_size, result, result_size);
+    slot->function = handle + 1;
+    slot->args_size = args_size;
+    slot->result_size = result_size;
+    cache_unlock(cache);
+}
+
+void rpc_cache_invalidate(const rpc_dispatcher_t *dispatcher, size_t function_index) {
+    rpc_cache_t *cache = dispatcher->cache;
+    if (cache == NULL) return;
+
+    // the generation is cache wide, so results of other functions that are being computed are dropped as well
+    cache_lock(cache);
+    __atomic_add_fetch(&cache->generation, 1, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        if (cache->slots[i].function == function_index + 1) cache->slots[i].function = 0;
+    }
+    cache_unlock(cache);
+}
+
+void rpc_cache_invalidate_all(const rpc_dispatcher_t *dispatcher) {
+    rpc_cache_t *cache = dispatcher->cache;
+    if (cache == NULL) return;
+
+    cache_lock(cache);
+    __atomic_add_fetch(&cache->generation, 1, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < cache->slot_count; i++) cache->slots[i].function = 0;
+    cache_unlock(cache);
+}
+
+// Decodes the request at request_it and runs its handler, writing the {"id","res"} response to output. When an
+// error is returned the contents of output are undefined, callers roll it back and encode an error response instead.
+// RPC_PENDING is returned when the handler deferred the call, nothing written to output is needed then either.
+static rpc_error_t execute_request(const rpc_dispatcher_t *dispatcher, CborValue *request_it, rpc_output_t *output,
+                                   bool deferrable, rpc_iovec_t *reference, uint64_t *transaction_id, bool *compact,
+                                   const char **error_msg, void *user_ptr) {
+    rpc_request_t request;
+    STATS_TIMESTAMP(timestamp);
+
+    rpc_error_t decode_result = decode_request(dispatcher, request_it, &request);
+    *transaction_id = request.transaction_id;
+    *compact = request.compact;
+    STATS_PHASE(dispatcher, RPC_STATS_PARSE, timestamp);
+    if (decode_result != RPC_OK) return decode_result;
+
+    rpc_error_t validate_result = validate_request(&request);
+    STATS_PHASE(dispatcher, RPC_STATS_VALIDATE, timestamp);
+    if (validate_result != RPC_OK) return validate_result;
+
+    uint8_t header[RESPONSE_HEADER_MAX_SIZE];
+    output_write(output, header, encode_response_header(header, request.transaction_id, request.compact, RPC_KEY_RES));
+
+    // only results encoded to a flat buffer can be stored, the args of a lazy call were never measured
+    const bool cacheable = request.function->cacheable && dispatcher->cache != NULL &&
+                           output->stream == NULL && !output->overflow && !request.args_lazy;
+
+    if (cacheable && cache_lookup(dispatcher->cache, request.handle, request.args, request.args_size, output)) {
+        STATS_FUNCTION(dispatcher, request.handle, RPC_OK, timestamp);
+        return RPC_OK;
+    }
+
+    const size_t generation = cacheable ? cache_generation(dispatcher->cache) : 0;
+
+    // execute rpc function
+    rpc_call_t call = {.transaction_id = request.transaction_id, .compact = request.compact, .output = output,
+                       .deferrable = deferrable, .deferred = false, .reference = reference};
+    const size_t result_start = output->used;
+    output_begin_payload(output, &call.encoder);
+
+    rpc_error_t rpc_result = request.function->function_ptr(&request.args_it, &call.encoder, error_msg, user_ptr);
+
+    output_end_payload(output, &call.encoder);
+    STATS_FUNCTION(dispatcher, request.handle, rpc_result, timestamp);
+
+    if (cacheable && rpc_result == RPC_OK && *error_msg == NULL && !output->overflow && !call.deferred &&
+        (reference == NULL || reference->data == NULL)) {
+        cache_store(dispatcher->cache, generation, request.handle, request.args, request.args_size,
+                    output->buffer + result_start, output->used - result_start);
+    }
+
+    // a handler that returns RPC_PENDING without a token could never be answered
+    if (rpc_result == RPC_PENDING && !call.deferred) return RPC_ERROR_INTERNAL_ERROR;
+    return rpc_result;
+}
+
 static const char *error_to_string(rpc_error_t error) {
     switch (error) {
         case RPC_ERROR_METHOD_NOT_FOUND:
@@ -224,6 +1015,12 @@ static const char *error_to_string(rpc_error_t error) {
         case RPC_ERROR_PARSER_FAILED:
             return "Internal error (parser failed)";
 
+        case RPC_ERROR_TOO_MANY_REQUESTS:
+            return "Too many requests in flight";
+
+        case RPC_ERROR_LIMIT_EXCEEDED:
+            return "Request exceeds limits";
+
         case RPC_ERROR_INVALID_REQUEST:
             return "Invalid request";
 
@@ -238,68 +1035,312 @@ static const char *error_to_string(rpc_error_t error) {
     }
 }
 
-static const uint8_t encode_error_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0D, 0x63, 0x65, 0x72, 0x72, 0xA2, 0x61, 0x63, 0x39, 0x7D, 0x62, 0x63, 0x6D, 0x73, 0x67, 0x6C, 0x65, 0x6E, 0x63, 0x6F, 0x64, 0x65, 0x5F, 0x65, 0x72, 0x72, 0x6F, 0x72};
-
 #define CHECK_CBOR_ENCODE_OR_SET(X, Y) if (X != CborNoError) { Y = false; }
 
+static void encode_error(rpc_output_t *output, uint64_t transaction_id, bool compact, rpc_error_t err,
+                         const char *error_msg) {
+    if (error_msg == NULL) error_msg = error_to_string(err);
+    size_t error_msg_size = strlen(error_msg);
+
+    uint8_t header[RESPONSE_HEADER_MAX_SIZE];
+    size_t size = encode_response_header(header, transaction_id, compact, RPC_KEY_ERR);
+    size += rpc_encode_head(header + size, 5, 2);
+
+    // error codes are negative, CBOR stores them as -1 - value
+    size = append_key(header, size, compact, RPC_KEY_CODE);
+    size += rpc_encode_head(header + size, 1, (uint64_t) (-1 - (int64_t) err));
+
+    size = append_key(header, size, compact, RPC_KEY_MSG);
+    size += rpc_encode_head(header + size, 3, error_msg_size);
+
+    output_write(output, header, size);
+    output_write(output, (const uint8_t *) error_msg, error_msg_size);
+}
+
+// Replaces whatever was encoded with the error response if the call failed and sets the final response size
+static rpc_error_t finish_response(rpc_output_t *output, size_t *output_buffer_size, uint64_t transaction_id,
+                                   bool compact, rpc_error_t err, const char *error_msg) {
+    if (err != RPC_OK || error_msg != NULL) {
+        // discard whatever the handler managed to write and start over with the error response
+        output->used = 0;
+        output->overflow = false;
+        encode_error(output, transaction_id, compact, err, error_msg);
+
+        if (output->overflow) {
+            // the message does not fit, fall back to the short encode error with the same id and keys
+            output->used = 0;
+            output->overflow = false;
+            encode_error(output, transaction_id, compact, RPC_ERROR_ENCODE_ERROR, "encode_error");
+
+            if (output->overflow) {
+                *output_buffer_size = 0;
+                return RPC_ERROR_ENCODE_ERROR;
+            }
+        }
+    }
+
+    *output_buffer_size = output->used;
+
+    return err;
+}
+
 rpc_error_t
-execute_rpc_call(const rpc_function_entry_t *rpc_functions, size_t rpc_functions_count, const uint8_t *input_buffer,
-                 size_t input_buffer_size, uint8_t *output_buffer, size_t *output_buffer_size,
-                 void *user_ptr) {
+execute_rpc_call(const rpc_dispatcher_t *dispatcher, const uint8_t *input_buffer, size_t input_buffer_size,
+                 uint8_t *output_buffer, size_t *output_buffer_size, void *user_ptr) {
+    CborParser parser;
+    CborValue request_it;
+    rpc_output_t output = {output_buffer, *output_buffer_size, 0, false, NULL};
 
-    size_t saved_buffer_size = *output_buffer_size;
     uint64_t transaction_id = 0;
-
+    bool compact = false;
     const char *error_msg = NULL;
-    rpc_error_t err = execute_rpc_call_internal(rpc_functions, rpc_functions_count, input_buffer, input_buffer_size,
-                                                output_buffer, output_buffer_size, &transaction_id,
-                                                &error_msg, user_ptr);
+    rpc_error_t err;
 
-    if (err != RPC_OK || error_msg != NULL) {
-        size_t map_key_count = 1;
-        if (transaction_id != 0) {
-            map_key_count = 2;
+    if (cbor_parser_init(input_buffer, input_buffer_size, RPC_PARSER_FLAGS, &parser, &request_it) != CborNoError) {
+        err = RPC_ERROR_INTERNAL_ERROR;
+    } else {
+        err = execute_request(dispatcher, &request_it, &output, true, NULL, &transaction_id, &compact, &error_msg,
+                              user_ptr);
+
+        if (err == RPC_PENDING) {
+            *output_buffer_size = 0;
+            STATS_BYTES(dispatcher, input_buffer_size, 0);
+            return RPC_PENDING;
         }
 
-        CborEncoder response_encoder, map_encoder;
+        if (output.overflow) err = RPC_ERROR_ENCODE_ERROR;
+    }
 
-        cbor_encoder_init(&response_encoder, output_buffer, saved_buffer_size, 0);
-        cbor_encoder_create_map(&response_encoder, &map_encoder, map_key_count);
+    STATS_TIMESTAMP(timestamp);
+    rpc_error_t result = finish_response(&output, output_buffer_size, transaction_id, compact, err, error_msg);
 
-        if (transaction_id != 0) {
-            cbor_encode_text_stringz(&map_encoder, "id");
-            cbor_encode_uint(&map_encoder, transaction_id);
+    STATS_PHASE(dispatcher, RPC_STATS_ENCODE, timestamp);
+    STATS_ERROR(dispatcher, result);
+    STATS_BYTES(dispatcher, input_buffer_size, *output_buffer_size);
+    return result;
+}
+
+rpc_error_t
+execute_rpc_call_iov(const rpc_dispatcher_t *dispatcher, const uint8_t *input_buffer, size_t input_buffer_size,
+                     uint8_t *output_buffer, size_t output_buffer_size, rpc_iovec_t iov[RPC_IOV_MAX],
+                     size_t *iov_count, void *user_ptr) {
+    CborParser parser;
+    CborValue request_it;
+    rpc_output_t output = {output_buffer, output_buffer_size, 0, false, NULL};
+    rpc_iovec_t reference = {NULL, 0};
+
+    uint64_t transaction_id = 0;
+    bool compact = false;
+    const char *error_msg = NULL;
+    rpc_error_t err;
+
+    *iov_count = 0;
+
+    if (cbor_parser_init(input_buffer, input_buffer_size, RPC_PARSER_FLAGS, &parser, &request_it) != CborNoError) {
+        err = RPC_ERROR_INTERNAL_ERROR;
+    } else {
+        err = execute_request(dispatcher, &request_it, &output, true, &reference, &transaction_id, &compact,
+                              &error_msg, user_ptr);
+
+        if (err == RPC_PENDING) {
+            STATS_BYTES(dispatcher, input_buffer_size, 0);
+            return RPC_PENDING;
         }
 
-        cbor_encode_text_stringz(&map_encoder, "err");
+        if (output.overflow) err = RPC_ERROR_ENCODE_ERROR;
+    }
+
+    STATS_TIMESTAMP(timestamp);
+    size_t response_size;
+    rpc_error_t result = finish_response(&output, &response_size, transaction_id, compact, err, error_msg);
 
-        CborEncoder error_map_encoder;
-        cbor_encoder_create_map(&map_encoder, &error_map_encoder, 2);
+    STATS_PHASE(dispatcher, RPC_STATS_ENCODE, timestamp);
+    STATS_ERROR(dispatcher, result);
 
-        cbor_encode_text_stringz(&error_map_encoder, "c");
-        cbor_encode_int(&error_map_encoder, err);
+    if (response_size != 0) {
+        iov[(*iov_count)++] = (rpc_iovec_t) {output_buffer, response_size};
 
-        cbor_encode_text_stringz(&error_map_encoder, "msg");
+        // an error response replaced the result and whatever it referenced
+        if (err == RPC_OK && error_msg == NULL && reference.data != NULL) iov[(*iov_count)++] = reference;
+    }
+
+    STATS_BYTES(dispatcher, input_buffer_size, response_size + (*iov_count == 2 ? reference.size : 0));
+    return result;
+}
 
-        if (error_msg != NULL) cbor_encode_text_stringz(&error_map_encoder, error_msg);
-        else cbor_encode_text_stringz(&error_map_encoder, error_to_string(err));
+rpc_error_t rpc_complete(const rpc_deferred_t *token, rpc_complete_function_t complete, void *complete_ptr,
+                         uint8_t *output_buffer, size_t *output_buffer_size) {
+    rpc_output_t output = {output_buffer, *output_buffer_size, 0, false, NULL};
+    const char *error_msg = NULL;
 
-        cbor_encoder_close_container(&map_encoder, &error_map_encoder);
+    uint8_t header[RESPONSE_HEADER_MAX_SIZE];
+    output_write(&output, header, encode_response_header(header, token->transaction_id, token->compact, RPC_KEY_RES));
 
-        cbor_encoder_close_container(&response_encoder, &map_encoder);
+    // the call is answered now, it can not be deferred a second time
+    rpc_call_t call = {.transaction_id = token->transaction_id, .compact = token->compact, .output = &output,
+                       .deferrable = false, .deferred = false, .reference = NULL};
+    output_begin_payload(&output, &call.encoder);
 
-        if (cbor_encoder_get_extra_bytes_needed(&error_map_encoder) != 0) {
-            if (*output_buffer_size > sizeof(encode_error_response)) {
-                memcpy(output_buffer, encode_error_response, sizeof(encode_error_response));
-                *output_buffer_size = sizeof(encode_error_response);
-            } else {
-                *output_buffer_size = 0;
-                return RPC_ERROR_ENCODE_ERROR;
+    rpc_error_t err = complete(&call.encoder, &error_msg, complete_ptr);
+
+    output_end_payload(&output, &call.encoder);
+
+    if (err == RPC_PENDING) err = RPC_ERROR_INTERNAL_ERROR;
+    if (output.overflow) err = RPC_ERROR_ENCODE_ERROR;
+
+    return finish_response(&output, output_buffer_size, token->transaction_id, token->compact, err, error_msg);
+}
+
+rpc_error_t
+execute_rpc_call_streaming(const rpc_dispatcher_t *dispatcher, const uint8_t *input_buffer, size_t input_buffer_size,
+                           uint8_t *chunk_buffer, size_t chunk_buffer_size, rpc_flush_function_t flush,
+                           void *flush_ptr, void *user_ptr) {
+    CborParser parser;
+    CborValue request_it;
+    rpc_stream_t stream = {chunk_buffer, chunk_buffer_size, 0, 0, false, flush, flush_ptr};
+    rpc_output_t output = {NULL, 0, 0, false, &stream};
+
+    uint64_t transaction_id = 0;
+    bool compact = false;
+    const char *error_msg = NULL;
+    rpc_error_t err;
+
+    if (chunk_buffer_size == 0) return RPC_ERROR_ENCODE_ERROR;
+
+    if (cbor_parser_init(input_buffer, input_buffer_size, RPC_PARSER_FLAGS, &parser, &request_it) != CborNoError) {
+        err = RPC_ERROR_INTERNAL_ERROR;
+    } else {
+        err = execute_request(dispatcher, &request_it, &output, true, NULL, &transaction_id, &compact, &error_msg,
+                              user_ptr);
+    }
+
+    // rpc_defer made sure that nothing was flushed, the buffered response header is dropped
+    if (err == RPC_PENDING) return RPC_PENDING;
+    if (stream.failed) return RPC_ERROR_ENCODE_ERROR;
+
+    STATS_TIMESTAMP(timestamp);
+    if (err != RPC_OK || error_msg != NULL) {
+        // part of the result is already on the wire, there is no way to replace it with an error response
+        if (stream.flushed != 0) return RPC_ERROR_ENCODE_ERROR;
+
+        stream.used = 0;
+        encode_error(&output, transaction_id, compact, err, error_msg);
+    }
+    STATS_PHASE(dispatcher, RPC_STATS_ENCODE, timestamp);
+
+    if (!stream_flush(&stream)) return RPC_ERROR_ENCODE_ERROR;
+
+    STATS_ERROR(dispatcher, err);
+    STATS_BYTES(dispatcher, input_buffer_size, stream.flushed);
+    return err;
+}
+
+// Executes one entry of a batch and writes exactly one response for it, or none if it was deferred. Returns false
+// when the input is malformed to the point that the next entry cannot be located.
+static bool execute_batch_entry(const rpc_dispatcher_t *dispatcher, CborValue *request_it, rpc_output_t *output,
+                                bool deferrable, void *user_ptr) {
+    const uint8_t *request_start = cbor_value_get_next_byte(request_it);
+    const size_t saved_used = output->used;
+    const bool saved_overflow = output->overflow;
+
+    uint64_t transaction_id = 0;
+    bool compact = false;
+    const char *error_msg = NULL;
+    rpc_error_t err = execute_request(dispatcher, request_it, output, deferrable, NULL, &transaction_id, &compact,
+                                      &error_msg, user_ptr);
+
+    STATS_TIMESTAMP(timestamp);
+    if (err == RPC_PENDING) {
+        output->used = saved_used;
+        output->overflow = saved_overflow;
+    } else if (err != RPC_OK || error_msg != NULL) {
+        output->used = saved_used;
+        output->overflow = saved_overflow;
+        encode_error(output, transaction_id, compact, err, error_msg);
+    }
+    STATS_PHASE(dispatcher, RPC_STATS_ENCODE, timestamp);
+    STATS_ERROR(dispatcher, err);
+
+    // requests rejected before their map was walked and lazy calls still have to be stepped over
+    if (cbor_value_get_next_byte(request_it) == request_start) {
+        return cbor_value_advance(request_it) == CborNoError;
+    }
+
+    return true;
+}
+
+rpc_error_t
+execute_rpc_batch(const rpc_dispatcher_t *dispatcher, const uint8_t *input_buffer, size_t input_buffer_size,
+                  uint8_t *output_buffer, size_t *output_buffer_size, void *user_ptr) {
+    CborParser parser;
+    CborValue batch_it;
+    rpc_output_t output = {output_buffer, *output_buffer_size, 0, false, NULL};
+    rpc_error_t err = RPC_OK;
+
+    if (input_buffer_size > 0 &&
+        cbor_parser_init(input_buffer, input_buffer_size, RPC_PARSER_FLAGS, &parser, &batch_it) != CborNoError) {
+        *output_buffer_size = 0;
+        return RPC_ERROR_PARSER_FAILED;
+    }
+
+    if (input_buffer_size > 0 && cbor_value_is_array(&batch_it)) {
+        // array of requests, answered with an array of responses in the same order
+        size_t request_count = 0;
+        CborValue request_it;
+
+        if (cbor_value_get_array_length(&batch_it, &request_count) != CborNoError ||
+            cbor_value_enter_container(&batch_it, &request_it) != CborNoError) {
+            *output_buffer_size = 0;
+            return RPC_ERROR_PARSER_FAILED;
+        }
+
+        uint8_t array_header[9];
+        output_write(&output, array_header, rpc_encode_head(array_header, 4, request_count));
+
+        size_t i = 0;
+        for (; i < request_count; i++) {
+            // the response count is already written, every entry has to be answered right away
+            if (!execute_batch_entry(dispatcher, &request_it, &output, false, user_ptr)) {
+                err = RPC_ERROR_PARSER_FAILED;
+                i++;
+                break;
             }
-        } else {
-            *output_buffer_size = cbor_encoder_get_buffer_size(&response_encoder, output_buffer);
         }
+
+        // keep the response array well formed if the input could not be walked to the end
+        for (; i < request_count; i++) {
+            encode_error(&output, 0, false, RPC_ERROR_PARSER_FAILED, NULL);
+        }
+
+    } else {
+        // CBOR sequence of requests, answered with a sequence of responses; the parser is reinitialised in place
+        // at the start of every item
+        const uint8_t *next = input_buffer;
+        const uint8_t *end = input_buffer + input_buffer_size;
+
+        while (next < end) {
+            if (cbor_parser_init(next, end - next, RPC_PARSER_FLAGS, &parser, &batch_it) != CborNoError) {
+                encode_error(&output, 0, false, RPC_ERROR_PARSER_FAILED, NULL);
+                err = RPC_ERROR_PARSER_FAILED;
+                break;
+            }
+
+            if (!execute_batch_entry(dispatcher, &batch_it, &output, true, user_ptr)) {
+                err = RPC_ERROR_PARSER_FAILED;
+                break;
+            }
+
+            next = cbor_value_get_next_byte(&batch_it);
+        }
+    }
+
+    STATS_BYTES(dispatcher, input_buffer_size, output.overflow ? 0 : output.used);
+
+    if (output.overflow) {
+        *output_buffer_size = 0;
+        return RPC_ERROR_ENCODE_ERROR;
     }
 
+    *output_buffer_size = output.used;
     return err;
 }
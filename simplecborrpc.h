@@ -6,6 +6,23 @@
 #include <stddef.h>
 #include "cbor.h"
 
+// Maximum number of arguments a single rpc function can declare. The argument types of a request are recorded into a
+// fixed size array while the request is decoded, so this bounds the stack used per call.
+#ifndef SIMPLECBORRPC_MAX_ARGUMENTS
+#define SIMPLECBORRPC_MAX_ARGUMENTS 16
+#endif
+
+// Deepest nesting inside the arguments of a request that is checked against rpc_limits_t. The check walks the
+// arguments with one iterator per level in a fixed size array, deeper requests are rejected whatever the limits say.
+#ifndef SIMPLECBORRPC_MAX_DEPTH
+#define SIMPLECBORRPC_MAX_DEPTH 32
+#endif
+
+// Largest error response produced with the built-in messages: {"id": <uint64>, "err": {"c": <code>, "msg": <text>}}
+// where the longest message is "Internal error (parser failed)". Handlers that set a longer error_msg fall back to a
+// short canned error response when their message does not fit.
+#define RPC_ERROR_RESPONSE_MAX_SIZE (1 + 3 + 9 + 4 + 1 + 2 + 3 + 4 + 2 + 30)
+
 typedef enum {
     CBOR_TYPE_NULL = 0,
     CBOR_TYPE_BOOL,
@@ -29,8 +46,13 @@ typedef enum {
 typedef enum {
     RPC_OK = 0,
 
+    // returned by a handler that called rpc_defer, the response is produced later by rpc_complete
+    RPC_PENDING = 1,
+
     RPC_ERROR_PARSER_FAILED = -32000,
     RPC_ERROR_UNEXPECTED_KEY_IN_REQUEST = -32001,
+    RPC_ERROR_TOO_MANY_REQUESTS = -32002,
+    RPC_ERROR_LIMIT_EXCEEDED = -32003,
 
     RPC_ERROR_PARSE_ERROR = -32700,
     RPC_ERROR_INVALID_REQUEST = -32600,
@@ -41,6 +63,27 @@ typedef enum {
     RPC_ERROR_ENCODE_ERROR = -32099
 } rpc_error_t;
 
+// Map keys of the compact protocol mode. A request that uses these unsigned integers in place of the text keys is
+// answered with integer keys as well; the __compact built-in returns this mapping.
+typedef enum {
+    RPC_KEY_ID = 0,
+    RPC_KEY_FUNC,
+    RPC_KEY_ARGS,
+    RPC_KEY_RES,
+    RPC_KEY_ERR,
+    RPC_KEY_CODE,
+    RPC_KEY_MSG
+} rpc_key_t;
+
+// Bounds on the args array of a request, checked while the request is decoded and before any handler runs. depth is
+// how deeply containers nest inside an argument (an array argument is depth 1), items counts every data item inside
+// the args including map keys, string_bytes the length of all text and byte strings together. SIZE_MAX for no limit.
+typedef struct {
+    size_t depth;
+    size_t items;
+    size_t string_bytes;
+} rpc_limits_t;
+
 typedef rpc_error_t (*rpc_function_t)(const CborValue *args_iterator, CborEncoder *result, const char **error_msg,
                                       void *user_ptr);
 
@@ -51,6 +94,17 @@ struct rpc_function_entry_s{
 
     const rpc_argument_type_t *argument_types;
     const size_t number_of_arguments;
+
+    // only the number of arguments is checked before the call, the handler checks every argument with
+    // rpc_check_argument_type when it gets to it, so large arguments are walked once instead of twice
+    const bool lazy;
+
+    // the result only depends on the arguments, see rpc_cache_t
+    const bool cacheable;
+
+    // NULL for no limits. The arguments of a function with limits are always walked before the call, even if it is
+    // lazy.
+    const rpc_limits_t *limits;
 };
 
 typedef struct rpc_function_entry_s rpc_function_entry_t;
@@ -58,16 +112,240 @@ typedef struct rpc_function_entry_s rpc_function_entry_t;
 #define RPC_FUNC(X) rpc_error_t \
                     X(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr)
 
+// Point text or bytes straight at a definite length string inside the request buffer, no copy is made and the view
+// stays valid for as long as the input buffer does. RPC_ERROR_INVALID_ARGS is returned if it is not a string of that
+// kind or its length is indefinite.
+rpc_error_t rpc_get_text_string_view(const CborValue *it, const char **text, size_t *length);
+rpc_error_t rpc_get_byte_string_view(const CborValue *it, const uint8_t **bytes, size_t *length);
+
+// Returns RPC_ERROR_INVALID_ARGS unless the argument at it has type, for the handlers of lazy functions
+rpc_error_t rpc_check_argument_type(const CborValue *it, rpc_argument_type_t type);
+
+// One piece of a response that is sent with writev or DMA scatter-gather instead of being assembled in one buffer
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} rpc_iovec_t;
+
+#define RPC_IOV_MAX 2
+
+// Encodes a byte string as the whole result of a handler, with result being the encoder the handler was given. Under
+// execute_rpc_call_iov only the byte string header is written to the output buffer and data is sent from where it
+// is, so data has to stay valid until the response went out. The other execute functions copy it like
+// cbor_encode_byte_string. Nothing else may be encoded into result.
+CborError rpc_encode_byte_string_reference(CborEncoder *result, const uint8_t *data, size_t size);
+
+// Copies one data item that was encoded ahead of time (e.g. by api_gen.py) as the whole result of a handler, with
+// result being the encoder the handler was given. Nothing else may be encoded into result.
+CborError rpc_encode_preencoded(CborEncoder *result, const uint8_t *data, size_t size);
+
+// Identifies a deferred call, the transaction id and key mode are all that is needed to answer it later
+typedef struct {
+    uint64_t transaction_id;
+    bool compact;
+} rpc_deferred_t;
+
+// Called by a handler, with the result encoder it was given, that finishes its work after returning. Fills token and
+// returns RPC_PENDING, which the handler returns in turn; execute_rpc_call then produces no response and returns
+// RPC_PENDING as well. Calls inside a batch array and streamed calls that already flushed data cannot be deferred,
+// RPC_ERROR_INTERNAL_ERROR is returned for those and the handler has to answer synchronously or fail.
+rpc_error_t rpc_defer(CborEncoder *result, rpc_deferred_t *token);
+
+// Encodes the result of a deferred call, called by rpc_complete the same way a handler is called
+typedef rpc_error_t (*rpc_complete_function_t)(CborEncoder *result, const char **error_msg, void *complete_ptr);
+
+// Writes the {"id","res"} (or {"id","err"}) response for a deferred call to output_buffer, matched to its request by
+// the transaction id. Can be called from any thread, the dispatcher is not involved any more.
+rpc_error_t rpc_complete(const rpc_deferred_t *token, rpc_complete_function_t complete, void *complete_ptr,
+                         uint8_t *output_buffer, size_t *output_buffer_size);
+
 #define RPC_ARGS(...) (rpc_argument_type_t[]){ __VA_ARGS__ }, sizeof((rpc_argument_type_t[]) { __VA_ARGS__ })/sizeof(rpc_argument_type_t)
 #define RPC_NO_ARGS NULL, 0
 
+#ifdef SIMPLECBORRPC_ENABLE_STATS
+// Number of latency buckets: bucket i counts durations of [2^i, 2^(i+1)) clock ticks, the last one also everything
+// longer. Ticks are nanoseconds unless SIMPLECBORRPC_STATS_CLOCK() is defined to return a uint64_t from another clock.
+#ifndef SIMPLECBORRPC_STATS_BUCKETS
+#define SIMPLECBORRPC_STATS_BUCKETS 24
+#endif
+
+// the error codes listed in rpc_stats_error_codes, plus one slot for any other code
+#define RPC_STATS_ERROR_KINDS 11
+
+typedef enum {
+    RPC_STATS_PARSE = 0,    // walking the request map
+    RPC_STATS_VALIDATE,     // checking the argument types
+    RPC_STATS_HANDLER,      // the rpc function, including the result it encodes
+    RPC_STATS_ENCODE,       // finishing the response, or replacing it with an error response
+    RPC_STATS_PHASE_COUNT
+} rpc_stats_phase_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t errors;
+    uint32_t latency[SIMPLECBORRPC_STATS_BUCKETS];
+} rpc_function_stats_t;
+
+// Counters of one dispatcher, updated with relaxed atomics so that concurrent callers can share it
+typedef struct {
+    rpc_function_stats_t *functions;    // function_count entries, indexed like the function table
+
+    uint64_t request_bytes;
+    uint64_t response_bytes;
+    uint32_t errors[RPC_STATS_ERROR_KINDS];
+    uint32_t phases[RPC_STATS_PHASE_COUNT][SIMPLECBORRPC_STATS_BUCKETS];
+} rpc_stats_t;
+
+extern const rpc_error_t rpc_stats_error_codes[RPC_STATS_ERROR_KINDS - 1];
+
+// Largest __stats result of a table with function_count functions whose names take name_bytes encoded as CBOR text,
+// with every counter at its largest: a histogram is an array of uint32, an error kind a negative code or "other"
+#define RPC_STATS_HISTOGRAM_MAX_SIZE (3 + SIMPLECBORRPC_STATS_BUCKETS * 5)
+#define RPC_STATS_MAX_RESULT_SIZE(function_count, name_bytes) \
+        (1 + (6 + 1 + 2 * 9) + (7 + 1 + (RPC_STATS_ERROR_KINDS - 1) * (3 + 5) + 6 + 5) + \
+         (7 + 1 + 30 + RPC_STATS_PHASE_COUNT * RPC_STATS_HISTOGRAM_MAX_SIZE) + \
+         (10 + 9 + (name_bytes) + (function_count) * (1 + 5 + 5 + RPC_STATS_HISTOGRAM_MAX_SIZE)))
+#else
+// __stats answers with an error response
+#define RPC_STATS_MAX_RESULT_SIZE(function_count, name_bytes) 0
+#endif
+
+// One slot of a response cache, its region of the cache memory holds the raw args array of the request followed by
+// the encoded result
+typedef struct {
+    size_t function;    // function index + 1, 0 while the slot is empty
+    size_t args_size;
+    size_t result_size;
+} rpc_cache_slot_t;
+
+// Results of the cacheable functions of a table, keyed by function index and the raw bytes of the args array. The
+// cache is direct mapped: every key has exactly one slot and replaces whatever was cached there before, so lookups
+// and memory use are bounded by slot_count and slot_size. Results that do not fit in a slot are not cached.
+typedef struct {
+    rpc_cache_slot_t *slots;
+    size_t slot_count;
+
+    uint8_t *memory;    // slot_count regions of slot_size bytes
+    size_t slot_size;
+
+    bool lock;
+
+    // counts the invalidations, a result is only stored if none happened while its handler ran
+    size_t generation;
+} rpc_cache_t;
+
+typedef enum {
+    RPC_REGISTRY_OK = 0,
+    // the dispatcher has no registry, it was not initialised or the capacity is not a power of two
+    RPC_REGISTRY_INVALID,
+    RPC_REGISTRY_NAME_TAKEN,
+    RPC_REGISTRY_FULL,
+    RPC_REGISTRY_NOT_FOUND
+} rpc_registry_status_t;
+
+// One slot of a registry, function is NULL while the slot is free
+typedef struct {
+    const rpc_function_entry_t *function;
+    uint32_t hash;
+} rpc_registry_slot_t;
+
+// Functions registered at run time next to the generated table of a dispatcher, e.g. by modules loaded as plugins.
+// The slots are an open addressing hash index over the function names in memory owned by the caller; lookups take
+// no lock and run concurrently with a single thread that registers and unregisters functions.
+typedef struct {
+    rpc_registry_slot_t *slots;
+    size_t capacity;    // a power of two, 0 until rpc_registry_init was called
+} rpc_registry_t;
+
+// One generated function table together with its perfect hash. api_gen.py emits a const <prefix>_dispatcher for every
+// table, so several tables can be served from one binary; dispatchers are never written to and can be shared between
+// threads.
+typedef struct {
+    const rpc_function_entry_t *functions;
+    size_t function_count;
+
+    // the two hash salts interleaved, salt_size pairs
+    const uint16_t *salts;
+    size_t salt_size;
+
+    const uint16_t *graph;
+    size_t graph_size;
+
+    const uint8_t *key_lengths;
+
+    // NULL for tables without cacheable functions; like stats, the cache is written to through a const dispatcher
+    rpc_cache_t *cache;
+
+    // empty unless rpc_registry_init gave it slots
+    rpc_registry_t *registry;
+
+    // bounds the walk over args that come before func in a request, when the function is not known yet; the loosest
+    // limits of any function in the table, NULL unless every function has limits
+    const rpc_limits_t *limits;
+
+#ifdef SIMPLECBORRPC_ENABLE_STATS
+    rpc_stats_t *stats;
+#endif
+} rpc_dispatcher_t;
+
+rpc_error_t
+execute_rpc_call(const rpc_dispatcher_t *dispatcher, const uint8_t *input_buffer, size_t input_buffer_size,
+                 uint8_t *output_buffer, size_t *output_buffer_size, void *user_ptr);
+
+// Same as execute_rpc_call, but the response is returned as the *iov_count pieces in iov, the first one in
+// output_buffer and the second one, if any, being the memory a handler passed to rpc_encode_byte_string_reference.
+// output_buffer only has to hold the response framing, however large the referenced payload is.
+rpc_error_t
+execute_rpc_call_iov(const rpc_dispatcher_t *dispatcher, const uint8_t *input_buffer, size_t input_buffer_size,
+                     uint8_t *output_buffer, size_t output_buffer_size, rpc_iovec_t iov[RPC_IOV_MAX],
+                     size_t *iov_count, void *user_ptr);
+
+// Executes several requests from one input buffer. The input is either a CBOR array of request maps, answered with
+// an array of responses in the same order, or a CBOR sequence of request maps, answered with a sequence of responses.
+// Every entry gets its own {"id","res"} or {"id","err"} response, except for entries of a sequence that were deferred
+// with rpc_defer; RPC_OK is returned unless the batch itself could
+// not be walked (RPC_ERROR_PARSER_FAILED) or the responses do not fit in output_buffer (RPC_ERROR_ENCODE_ERROR).
 rpc_error_t
-execute_rpc_call(const rpc_function_entry_t *rpc_functions, size_t rpc_functions_count, const uint8_t *input_buffer,
-                 size_t input_buffer_size, uint8_t *output_buffer, size_t *output_buffer_size,
-                 void *user_ptr);
+execute_rpc_batch(const rpc_dispatcher_t *dispatcher, const uint8_t *input_buffer, size_t input_buffer_size,
+                  uint8_t *output_buffer, size_t *output_buffer_size, void *user_ptr);
+
+// Called by the streaming encoder whenever the chunk buffer is full and once more at the end of the response.
+// Returning false aborts the call with RPC_ERROR_ENCODE_ERROR.
+typedef bool (*rpc_flush_function_t)(const uint8_t *data, size_t size, void *flush_ptr);
+
+// Same as execute_rpc_call, but the response is written through chunk_buffer and handed to flush every time the
+// chunk fills up, so the response can be much larger than any buffer. Error responses replace the result as long as
+// nothing has been flushed yet; if a handler fails after the first chunk went out, RPC_ERROR_ENCODE_ERROR is returned
+// and the receiver has been sent a truncated response.
+rpc_error_t
+execute_rpc_call_streaming(const rpc_dispatcher_t *dispatcher, const uint8_t *input_buffer, size_t input_buffer_size,
+                           uint8_t *chunk_buffer, size_t chunk_buffer_size, rpc_flush_function_t flush,
+                           void *flush_ptr, void *user_ptr);
+
+// Returns the index of the function called name, or (size_t) -1. name does not need to be null terminated, so it can
+// point straight into the request buffer. Registered functions have the indices from rpc_get_key_count on, which
+// is the size of the generated table only.
+size_t rpc_lookup_index_by_name(const rpc_dispatcher_t *dispatcher, const char *name, size_t length);
+size_t rpc_lookup_index_by_key(const rpc_dispatcher_t *dispatcher, const char *key);
+const char *rpc_lookup_key_by_index(const rpc_dispatcher_t *dispatcher, size_t index);
+size_t rpc_get_key_count(const rpc_dispatcher_t *dispatcher);
+
+// Drops the cached results of one function, or of every function, after whatever they depend on has changed
+void rpc_cache_invalidate(const rpc_dispatcher_t *dispatcher, size_t function_index);
+void rpc_cache_invalidate_all(const rpc_dispatcher_t *dispatcher);
+
+// Gives the registry of dispatcher capacity slots, which stay owned by the caller. capacity has to be a power of two;
+// call it once, before the dispatcher serves requests.
+rpc_registry_status_t
+rpc_registry_init(const rpc_dispatcher_t *dispatcher, rpc_registry_slot_t *slots, size_t capacity);
+
+// Adds function to the registry of dispatcher, from then on it is called by name like the functions of the table.
+// Returns RPC_REGISTRY_NAME_TAKEN if the table or the registry has a function of that name already and
+// RPC_REGISTRY_FULL if there is no free slot. Only one thread at a time may register and unregister functions.
+rpc_registry_status_t rpc_register_function(const rpc_dispatcher_t *dispatcher, const rpc_function_entry_t *function);
 
-size_t rpc_lookup_index_by_key(const char *key);
-const char *rpc_lookup_key_by_index(size_t index);
-size_t rpc_get_key_count();
+// Removes a registered function, RPC_REGISTRY_NOT_FOUND if there is none called name. Calls that looked it up
+// before may still be running, so the entry and its handler have to stay valid until those are done.
+rpc_registry_status_t rpc_unregister_function(const rpc_dispatcher_t *dispatcher, const char *name);
 
 #endif //SIMPLECBORRPC_SIMPLECBORRPC_H
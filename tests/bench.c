@@ -0,0 +1,318 @@
+/* SPDX-License-Identifier: MIT */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simplecborrpc.h"
+#include "rpc_api.h"
+
+// Dispatch path benchmark, configure with -DCMAKE_BUILD_TYPE=Release for representative numbers.
+// Every case is run as BENCH_SAMPLES timed batches of calls, the percentiles are taken over the per-call average of
+// each batch so that the clock overhead stays out of the numbers. Batches are sized to take about BENCH_BATCH_NS from
+// a calibration run, so cheap and expensive cases are measured with the same precision and run time.
+#define BENCH_SAMPLES 2000
+#define BENCH_BATCH_NS 20000
+
+#define BENCH_RESPONSE_BUFFER_SIZE 512
+
+typedef struct {
+    const char *name;
+    const uint8_t *request;
+    size_t request_size;
+    size_t response_buffer_size;
+} bench_case_t;
+
+// request vectors are the same ones used by tests/main.c
+
+// {"id": 13, "func": "__version"}
+static const uint8_t version_request[] = {0xA2, 0x62, 0x69, 0x64, 0x0D,
+                                          0x64, 0x66, 0x75, 0x6E, 0x63,
+                                          0x69, 0x5F, 0x5F, 0x76, 0x65,
+                                          0x72, 0x73, 0x69, 0x6F, 0x6E};
+
+// {"id": 12, "func": "__ping"}
+static const uint8_t ping_request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                       0x64, 0x66, 0x75, 0x6E, 0x63,
+                                       0x66, 0x5F, 0x5F, 0x70, 0x69,
+                                       0x6E, 0x67};
+
+// {"id": 12, "func": 1}
+static const uint8_t ping_by_index_request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                                0x64, 0x66, 0x75, 0x6E, 0x63,
+                                                0x01};
+
+// {"id": 12, "func": "__funcs"}
+static const uint8_t func_list_request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                            0x64, 0x66, 0x75, 0x6E, 0x63,
+                                            0x67, 0x5F, 0x5F, 0x66, 0x75,
+                                            0x6E, 0x63, 0x73};
+
+// {"id": 12, "func": "echo", "args":["cake"]}
+static const uint8_t echo_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                                       0x64, 0x66, 0x75, 0x6E, 0x63,
+                                       0x64, 0x65, 0x63, 0x68, 0x6F,
+                                       0x64, 0x61, 0x72, 0x67, 0x73,
+                                       0x81, 0x64, 0x63, 0x61, 0x6B,
+                                       0x65};
+
+// {"id": 13, "func": "sum_array", "args":[[1,2,3,4,5]]}
+static const uint8_t sum_array_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0D,
+                                            0x64, 0x66, 0x75, 0x6E, 0x63,
+                                            0x69, 0x73, 0x75, 0x6D, 0x5F,
+                                            0x61, 0x72, 0x72, 0x61, 0x79,
+                                            0x64, 0x61, 0x72, 0x67, 0x73,
+                                            0x81, 0x85, 0x01, 0x02, 0x03,
+                                            0x04, 0x05};
+
+// {"id": 12, "func": "always_error", "args":[]}
+static const uint8_t error_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                                        0x64, 0x66, 0x75, 0x6E, 0x63,
+                                        0x6C, 0x61, 0x6C, 0x77, 0x61,
+                                        0x79, 0x73, 0x5F, 0x65, 0x72,
+                                        0x72, 0x6F, 0x72, 0x64, 0x61,
+                                        0x72, 0x67, 0x73, 0x80};
+
+// {"id": 12, "func": "sum_array", "args":[[1, "a"]]}
+static const uint8_t invalid_args_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                                               0x64, 0x66, 0x75, 0x6E, 0x63,
+                                               0x69, 0x73, 0x75, 0x6D, 0x5F,
+                                               0x61, 0x72, 0x72, 0x61, 0x79,
+                                               0x64, 0x61, 0x72, 0x67, 0x73,
+                                               0x81, 0x82, 0x01, 0x61, 0x61};
+
+// {"id": 12, "func": "missing_function", "args":[]}
+static const uint8_t method_not_found_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                                                   0x64, 0x66, 0x75, 0x6E, 0x63,
+                                                   0x70, 0x6D, 0x69, 0x73, 0x73,
+                                                   0x69, 0x6E, 0x67, 0x5F, 0x66,
+                                                   0x75, 0x6E, 0x63, 0x74, 0x69,
+                                                   0x6F, 0x6E, 0x64, 0x61, 0x72,
+                                                   0x67, 0x73, 0x80};
+
+#define BENCH_CASE(X) {#X, X##_request, sizeof(X##_request), BENCH_RESPONSE_BUFFER_SIZE}
+
+static const bench_case_t bench_cases[] = {
+        BENCH_CASE(version),
+        BENCH_CASE(ping),
+        BENCH_CASE(ping_by_index),
+        BENCH_CASE(func_list),
+        BENCH_CASE(echo),
+        BENCH_CASE(sum_array),
+
+        // error paths
+        BENCH_CASE(error),
+        BENCH_CASE(invalid_args),
+        BENCH_CASE(method_not_found),
+
+        // buffer too small: the canned error response still fits, nothing fits at all
+        {"func_list_small_buffer", func_list_request, sizeof(func_list_request), 40},
+        {"ping_no_buffer", ping_request, sizeof(ping_request), 8},
+};
+
+static const size_t sum_array_sizes[] = {1, 16, 256, 1024};
+
+typedef struct {
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+} bench_result_t;
+
+typedef void (*bench_function_t)(const void *context);
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b) {
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// the number of calls that take about BENCH_BATCH_NS, at least one
+static size_t calibrate_batch_size(bench_function_t function, const void *context) {
+    size_t calls = 0;
+    uint64_t start = now_ns();
+    uint64_t elapsed;
+
+    do {
+        function(context);
+        calls++;
+        elapsed = now_ns() - start;
+    } while (elapsed < 10 * BENCH_BATCH_NS);
+
+    size_t batch_size = (size_t) ((uint64_t) calls * BENCH_BATCH_NS / elapsed);
+    return batch_size > 0 ? batch_size : 1;
+}
+
+static bench_result_t run_bench(bench_function_t function, const void *context) {
+    static double samples[BENCH_SAMPLES];
+    bench_result_t result;
+
+    // warm up
+    size_t batch_size = calibrate_batch_size(function, context);
+    for (size_t i = 0; i < BENCH_SAMPLES * batch_size / 10; i++) function(context);
+
+    double total = 0;
+    for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = now_ns();
+        for (size_t j = 0; j < batch_size; j++) function(context);
+        samples[i] = (double) (now_ns() - start) / (double) batch_size;
+        total += samples[i];
+    }
+
+    qsort(samples, BENCH_SAMPLES, sizeof(double), compare_samples);
+
+    result.mean = total / BENCH_SAMPLES;
+    result.p50 = samples[BENCH_SAMPLES / 2];
+    result.p90 = samples[BENCH_SAMPLES * 90 / 100];
+    result.p99 = samples[BENCH_SAMPLES * 99 / 100];
+    return result;
+}
+
+static void print_result(const char *name, bench_result_t result) {
+    printf("%-24s %10.1f %12.0f %10.1f %10.1f %10.1f\n", name, result.mean, 1e9 / result.mean, result.p50, result.p90,
+           result.p99);
+}
+
+static void call_case(const void *context) {
+    const bench_case_t *bench_case = (const bench_case_t *) context;
+    uint8_t response_buffer[BENCH_RESPONSE_BUFFER_SIZE];
+
+    size_t response_size = bench_case->response_buffer_size;
+    execute_rpc_call(&rpc_dispatcher, bench_case->request, bench_case->request_size,
+                     response_buffer, &response_size, NULL);
+}
+
+// the lookup results are added up here, so that the compiler can not drop the lookups
+static volatile size_t lookup_sink;
+
+// the lookups on their own, over every function in the table
+static void lookup_by_name(const void *context) {
+    for (size_t i = 0; i < rpc_get_key_count(&rpc_dispatcher); i++) {
+        const char *key = rpc_lookup_key_by_index(&rpc_dispatcher, i);
+        lookup_sink += rpc_lookup_index_by_name(&rpc_dispatcher, key, strlen(key));
+    }
+}
+
+static void lookup_by_index(const void *context) {
+    for (size_t i = 0; i < rpc_get_key_count(&rpc_dispatcher); i++) {
+        lookup_sink += (size_t) rpc_lookup_key_by_index(&rpc_dispatcher, i)[0];
+    }
+}
+
+// the same functions registered at run time under other names, the registry is kept half full
+#define BENCH_REGISTRY_CAPACITY 32
+#define BENCH_REGISTRY_NAME_SIZE 32
+
+static char registered_names[BENCH_REGISTRY_CAPACITY / 2][BENCH_REGISTRY_NAME_SIZE];
+static rpc_function_entry_t *registered_entries[BENCH_REGISTRY_CAPACITY / 2];
+static size_t registered_count;
+
+static void unregister_functions(void) {
+    for (size_t i = 0; i < registered_count; i++) {
+        rpc_unregister_function(&rpc_dispatcher, registered_names[i]);
+        free(registered_entries[i]);
+    }
+
+    registered_count = 0;
+}
+
+static bool register_functions(void) {
+    static rpc_registry_slot_t slots[BENCH_REGISTRY_CAPACITY];
+
+    if (rpc_registry_init(&rpc_dispatcher, slots, BENCH_REGISTRY_CAPACITY) != RPC_REGISTRY_OK) return false;
+
+    for (size_t i = 0; i < rpc_get_key_count(&rpc_dispatcher) && i < BENCH_REGISTRY_CAPACITY / 2; i++) {
+        snprintf(registered_names[i], BENCH_REGISTRY_NAME_SIZE, "plugin_%s", rpc_function_table[i].name);
+
+        // a copy of the table entry under the new name, entries have const members and are not assigned
+        rpc_function_entry_t *entry = malloc(sizeof(rpc_function_entry_t));
+        if (entry == NULL) return false;
+        memcpy(entry, &rpc_function_table[i], sizeof(rpc_function_entry_t));
+        entry->name = registered_names[i];
+
+        if (rpc_register_function(&rpc_dispatcher, entry) != RPC_REGISTRY_OK) {
+            free(entry);
+            return false;
+        }
+
+        registered_entries[registered_count++] = entry;
+    }
+
+    return true;
+}
+
+static void lookup_registered(const void *context) {
+    for (size_t i = 0; i < registered_count; i++) {
+        lookup_sink += rpc_lookup_index_by_name(&rpc_dispatcher, registered_names[i], strlen(registered_names[i]));
+    }
+}
+
+// {"id": 13, "func": "sum_array", "args":[[0, 1, 2, ...]]}
+static size_t encode_sum_array_request(uint8_t *buffer, size_t buffer_size, size_t count) {
+    CborEncoder encoder, map_encoder, args_encoder, values_encoder;
+    cbor_encoder_init(&encoder, buffer, buffer_size, 0);
+
+    cbor_encoder_create_map(&encoder, &map_encoder, 3);
+    cbor_encode_text_stringz(&map_encoder, "id");
+    cbor_encode_uint(&map_encoder, 13);
+    cbor_encode_text_stringz(&map_encoder, "func");
+    cbor_encode_text_stringz(&map_encoder, "sum_array");
+    cbor_encode_text_stringz(&map_encoder, "args");
+
+    cbor_encoder_create_array(&map_encoder, &args_encoder, 1);
+    cbor_encoder_create_array(&args_encoder, &values_encoder, count);
+    for (size_t i = 0; i < count; i++) cbor_encode_uint(&values_encoder, i);
+    cbor_encoder_close_container(&args_encoder, &values_encoder);
+    cbor_encoder_close_container(&map_encoder, &args_encoder);
+
+    if (cbor_encoder_close_container(&encoder, &map_encoder) != CborNoError) return 0;
+    return cbor_encoder_get_buffer_size(&encoder, buffer);
+}
+
+int main(void) {
+#ifndef __OPTIMIZE__
+    fprintf(stderr, "built without optimisation, configure with -DCMAKE_BUILD_TYPE=Release for real numbers\n");
+#endif
+
+    printf("%-24s %10s %12s %10s %10s %10s\n", "case", "ns/call", "calls/sec", "p50", "p90", "p99");
+
+    print_result("lookup_by_name (table)", run_bench(lookup_by_name, NULL));
+    print_result("lookup_by_index (table)", run_bench(lookup_by_index, NULL));
+
+    if (!register_functions()) {
+        unregister_functions();
+        return 1;
+    }
+    print_result("lookup_by_name (registry)", run_bench(lookup_registered, NULL));
+
+    for (size_t i = 0; i < sizeof(bench_cases) / sizeof(bench_case_t); i++) {
+        print_result(bench_cases[i].name, run_bench(call_case, &bench_cases[i]));
+    }
+
+    // the entries were allocated by register_functions
+    unregister_functions();
+
+    static uint8_t sum_array_buffer[8192];
+    for (size_t i = 0; i < sizeof(sum_array_sizes) / sizeof(size_t); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "sum_array_%zu", sum_array_sizes[i]);
+
+        bench_case_t bench_case = {name, sum_array_buffer, 0, BENCH_RESPONSE_BUFFER_SIZE};
+        bench_case.request_size = encode_sum_array_request(sum_array_buffer, sizeof(sum_array_buffer),
+                                                           sum_array_sizes[i]);
+        if (bench_case.request_size == 0) return 1;
+
+        print_result(name, run_bench(call_case, &bench_case));
+    }
+
+    return 0;
+}
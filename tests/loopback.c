@@ -0,0 +1,338 @@
+/* SPDX-License-Identifier: MIT */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simplecborrpc.h"
+#include "rpc_framing.h"
+#include "rpc_client.h"
+#include "rpc_api.h"
+
+// End-to-end throughput over in-process socketpairs: every connection has a server thread running
+// rpc_framing_process on the real dispatcher and a client with one thread sending length-prefixed sum_array requests
+// and one receiving the responses. At most depth requests of a connection are in flight at once. Latency is measured
+// per request from just before it is written to the socket until its response has been decoded, the percentiles only
+// cover requests that were answered correctly.
+//
+// usage: simplecborrpc_loopback [-c connections] [-d depth] [-n requests per connection] [-p payload[,payload...]]
+// with the payload given as the number of array elements summed per request.
+
+#define LOOPBACK_BUFFER_SIZE 16384
+#define LOOPBACK_MAX_PAYLOADS 8
+
+typedef struct {
+    size_t connections;
+    size_t depth;
+    size_t requests;
+    size_t payload;
+
+    // [0, 1, 2, ...], encoded once
+    const uint8_t *values;
+    size_t values_size;
+    int64_t expected_sum;
+} loopback_config_t;
+
+typedef struct {
+    const loopback_config_t *config;
+
+    int server_fd;
+    int client_fd;
+    pthread_t server_thread;
+    pthread_t sender_thread;
+    pthread_t receiver_thread;
+
+    sem_t window;
+    bool stopped;
+
+    uint8_t server_rx_buffer[LOOPBACK_BUFFER_SIZE];
+    uint8_t server_tx_buffer[LOOPBACK_BUFFER_SIZE];
+    uint8_t client_tx_buffer[LOOPBACK_BUFFER_SIZE];
+    uint8_t client_rx_buffer[LOOPBACK_BUFFER_SIZE];
+
+    // send time of every request, indexed by transaction id - 1
+    uint64_t *sent;
+    uint64_t *latencies;
+    size_t failures;
+} loopback_connection_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+
+        data += written;
+        size -= (size_t) written;
+    }
+
+    return true;
+}
+
+// reads whatever arrived into reader, false once the peer closed the connection
+static bool read_some(int fd, rpc_frame_reader_t *reader) {
+    size_t available;
+    uint8_t *buffer = rpc_frame_reader_get_write_buffer(reader, &available);
+
+    ssize_t count;
+    do {
+        count = read(fd, buffer, available);
+    } while (count < 0 && errno == EINTR);
+
+    if (count <= 0) return false;
+
+    rpc_frame_reader_commit(reader, (size_t) count);
+    return true;
+}
+
+static void *server_main(void *arg) {
+    loopback_connection_t *connection = (loopback_connection_t *) arg;
+
+    rpc_frame_reader_t reader;
+    rpc_frame_writer_t writer;
+    rpc_frame_reader_init(&reader, RPC_FRAMING_LENGTH_PREFIX, connection->server_rx_buffer, LOOPBACK_BUFFER_SIZE);
+    rpc_frame_writer_init(&writer, RPC_FRAMING_LENGTH_PREFIX, connection->server_tx_buffer, LOOPBACK_BUFFER_SIZE);
+
+    while (read_some(connection->server_fd, &reader)) {
+        // answer everything that arrived, sending whenever the transmit buffer fills up
+        for (;;) {
+            if (rpc_framing_process(&reader, &writer, &rpc_dispatcher, RPC_SUM_ARRAY_MAX_RESPONSE_SIZE, NULL) != RPC_OK) {
+                return NULL;
+            }
+
+            size_t pending;
+            const uint8_t *data = rpc_frame_writer_peek(&writer, &pending);
+            if (pending == 0) break;
+
+            if (!write_all(connection->server_fd, data, pending)) return NULL;
+            rpc_frame_writer_consume(&writer, pending);
+        }
+    }
+
+    return NULL;
+}
+
+static void *sender_main(void *arg) {
+    loopback_connection_t *connection = (loopback_connection_t *) arg;
+    const loopback_config_t *config = connection->config;
+    uint8_t *frame = connection->client_tx_buffer;
+
+    for (size_t i = 0; i < config->requests; i++) {
+        while (sem_wait(&connection->window) != 0); // EINTR
+        if (__atomic_load_n(&connection->stopped, __ATOMIC_ACQUIRE)) break;
+
+        size_t size = rpc_client_sum_array(frame + 2, LOOPBACK_BUFFER_SIZE - 2, i + 1, config->values,
+                                           config->values_size);
+        frame[0] = (uint8_t) (size >> 8);
+        frame[1] = (uint8_t) size;
+
+        __atomic_store_n(&connection->sent[i], now_ns(), __ATOMIC_RELAXED);
+        if (!write_all(connection->client_fd, frame, size + 2)) break;
+    }
+
+    return NULL;
+}
+
+static void *receiver_main(void *arg) {
+    loopback_connection_t *connection = (loopback_connection_t *) arg;
+    const loopback_config_t *config = connection->config;
+
+    rpc_frame_reader_t reader;
+    rpc_frame_reader_init(&reader, RPC_FRAMING_LENGTH_PREFIX, connection->client_rx_buffer, LOOPBACK_BUFFER_SIZE);
+
+    size_t received = 0;
+    while (received < config->requests && read_some(connection->client_fd, &reader)) {
+        const uint8_t *frame;
+        size_t frame_size;
+
+        while (rpc_frame_reader_next(&reader, &frame, &frame_size) == RPC_FRAME_COMPLETE) {
+            uint64_t now = now_ns();
+            rpc_client_response_t response;
+            int64_t sum;
+
+            if (rpc_client_decode_response(&response, frame, frame_size) != RPC_OK || response.error != RPC_OK ||
+                cbor_value_get_int64(&response.result, &sum) != CborNoError || sum != config->expected_sum ||
+                response.transaction_id == 0 || response.transaction_id > config->requests) {
+                connection->failures++;
+            } else {
+                size_t index = response.transaction_id - 1;
+                connection->latencies[index] = now - __atomic_load_n(&connection->sent[index], __ATOMIC_RELAXED);
+            }
+
+            rpc_frame_reader_release(&reader);
+            received++;
+            sem_post(&connection->window);
+        }
+    }
+
+    if (received < config->requests) {
+        // the connection broke, the sender must not wait for responses that never come
+        connection->failures += config->requests - received;
+        __atomic_store_n(&connection->stopped, true, __ATOMIC_RELEASE);
+        sem_post(&connection->window);
+    }
+
+    return NULL;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// the latency at per_mille of the count sorted latencies in microseconds, 0 without any
+static double latency_percentile(const uint64_t *latencies, size_t count, size_t per_mille) {
+    return count != 0 ? (double) latencies[count * per_mille / 1000] / 1e3 : 0;
+}
+
+static bool run_loopback(const loopback_config_t *config) {
+    const size_t total = config->connections * config->requests;
+    loopback_connection_t *connections = calloc(config->connections, sizeof(loopback_connection_t));
+    uint64_t *sent = calloc(total, sizeof(uint64_t));
+    uint64_t *latencies = calloc(total, sizeof(uint64_t));
+    if (connections == NULL || sent == NULL || latencies == NULL) return false;
+
+    for (size_t i = 0; i < config->connections; i++) {
+        loopback_connection_t *connection = &connections[i];
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return false;
+        if (sem_init(&connection->window, 0, (unsigned int) config->depth) != 0) return false;
+
+        connection->config = config;
+        connection->server_fd = fds[0];
+        connection->client_fd = fds[1];
+        connection->sent = sent + i * config->requests;
+        connection->latencies = latencies + i * config->requests;
+    }
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < config->connections; i++) {
+        loopback_connection_t *connection = &connections[i];
+
+        if (pthread_create(&connection->server_thread, NULL, server_main, connection) != 0 ||
+            pthread_create(&connection->receiver_thread, NULL, receiver_main, connection) != 0 ||
+            pthread_create(&connection->sender_thread, NULL, sender_main, connection) != 0) {
+            return false;
+        }
+    }
+
+    size_t failures = 0;
+    for (size_t i = 0; i < config->connections; i++) {
+        pthread_join(connections[i].sender_thread, NULL);
+        pthread_join(connections[i].receiver_thread, NULL);
+
+        // tells the server thread to stop
+        shutdown(connections[i].client_fd, SHUT_WR);
+        pthread_join(connections[i].server_thread, NULL);
+        failures += connections[i].failures;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < config->connections; i++) {
+        close(connections[i].server_fd);
+        close(connections[i].client_fd);
+        sem_destroy(&connections[i].window);
+    }
+
+    // failed requests never got a latency, a round trip over a socket takes more than a nanosecond
+    size_t recorded = 0;
+    for (size_t i = 0; i < total; i++) {
+        if (latencies[i] != 0) latencies[recorded++] = latencies[i];
+    }
+    qsort(latencies, recorded, sizeof(uint64_t), compare_latencies);
+
+    double seconds = (double) elapsed / 1e9;
+    printf("%8zu %8zu %8zu %12.0f %10.1f %10.1f %10.1f %10.1f\n", config->connections, config->depth,
+           config->payload, (double) total / seconds, (double) total * (double) config->values_size / seconds / 1e6,
+           latency_percentile(latencies, recorded, 500), latency_percentile(latencies, recorded, 990),
+           latency_percentile(latencies, recorded, 999));
+
+    free(latencies);
+    free(sent);
+    free(connections);
+
+    if (failures != 0) fprintf(stderr, "%zu requests failed\n", failures);
+    return failures == 0;
+}
+
+// [0, 1, ..., count - 1]
+static size_t encode_values(uint8_t *buffer, size_t buffer_size, size_t count) {
+    CborEncoder encoder, array_encoder;
+    cbor_encoder_init(&encoder, buffer, buffer_size, 0);
+
+    cbor_encoder_create_array(&encoder, &array_encoder, count);
+    for (size_t i = 0; i < count; i++) cbor_encode_uint(&array_encoder, i);
+
+    if (cbor_encoder_close_container(&encoder, &array_encoder) != CborNoError) return 0;
+    return cbor_encoder_get_buffer_size(&encoder, buffer);
+}
+
+int main(int argc, char **argv) {
+    loopback_config_t config = {.connections = 4, .depth = 16, .requests = 20000};
+    size_t payloads[LOOPBACK_MAX_PAYLOADS] = {1, 16, 256};
+    size_t payload_count = 3;
+
+    int option;
+    while ((option = getopt(argc, argv, "c:d:n:p:")) != -1) {
+        switch (option) {
+            case 'c':
+                config.connections = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                config.depth = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                config.requests = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                payload_count = 0;
+                for (char *token = strtok(optarg, ","); token != NULL && payload_count < LOOPBACK_MAX_PAYLOADS;
+                     token = strtok(NULL, ",")) {
+                    payloads[payload_count++] = strtoul(token, NULL, 10);
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-c connections] [-d depth] [-n requests] [-p payload[,payload...]]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+
+    if (config.connections == 0 || config.depth == 0 || config.requests == 0 || payload_count == 0) return 2;
+
+    printf("%8s %8s %8s %12s %10s %10s %10s %10s\n", "conns", "depth", "payload", "calls/sec", "MB/s", "p50 us",
+           "p99 us", "p999 us");
+
+    static uint8_t values[LOOPBACK_BUFFER_SIZE];
+    for (size_t i = 0; i < payload_count; i++) {
+        config.payload = payloads[i];
+        config.values = values;
+        config.values_size = encode_values(values, sizeof(values) / 2, payloads[i]);
+        config.expected_sum = (int64_t) (payloads[i] * (payloads[i] - 1) / 2);
+
+        if (config.values_size == 0) {
+            fprintf(stderr, "payload %zu does not fit in a frame\n", payloads[i]);
+            return 2;
+        }
+
+        if (!run_loopback(&config)) return 1;
+    }
+
+    return 0;
+}
@@ -1,67 +1,21 @@
 /* SPDX-License-Identifier: MIT */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <setjmp.h>
+#include <pthread.h>
+#include <sched.h>
 #include "cmocka.h"
 
 #include "simplecborrpc.h"
+#include "incremental_parser.h"
+#include "rpc_server.h"
+#include "rpc_framing.h"
+#include "rpc_session.h"
+#include "rpc_client.h"
 #include "rpc_api.h"
-
-rpc_error_t
-rpc__hidden_ping(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
-    cbor_encode_text_stringz(result, "pong");
-
-    return RPC_OK;
-}
-
-rpc_error_t
-rpc_echo(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
-    size_t string_length = 0;
-    cbor_value_get_string_length(args_iterator, &string_length);
-    if (string_length > 64) {
-        *error_msg = "String too long";
-        return RPC_ERROR_INVALID_ARGS;
-    }
-
-    char echobuf[64];
-    size_t echobuflen = sizeof(echobuf);
-    cbor_value_copy_text_string(args_iterator, echobuf, &echobuflen, NULL);
-    cbor_encode_text_string(result, echobuf, echobuflen);
-
-    return RPC_OK;
-}
-
-rpc_error_t
-rpc_always_error(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
-    *error_msg = "this is a test error";
-
-    return RPC_ERROR_INTERNAL_ERROR;
-}
-
-rpc_error_t
-rpc_sum_array(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
-    int64_t sum = 0;
-
-    CborValue iterator;
-    if (cbor_value_enter_container(args_iterator, &iterator) != CborNoError) return RPC_ERROR_PARSER_FAILED;
-    while (!cbor_value_at_end(&iterator)) {
-        if (cbor_value_is_integer(&iterator)) {
-            int64_t int_result;
-            cbor_value_get_int64(&iterator, &int_result);
-            sum += int_result;
-        } else {
-            *error_msg = "integers only";
-            return RPC_ERROR_INVALID_ARGS;
-        }
-
-        if (cbor_value_advance(&iterator) != CborNoError) return RPC_ERROR_PARSER_FAILED;
-    }
-
-    cbor_encode_int(result, sum);
-    return RPC_OK;
-}
-
-//////////////////////////////////
+#include "alt_api.h"
 
 static void version_test(void **state) {
     // request: {"id": 13, "func": "__version"}
@@ -78,7 +32,7 @@ static void version_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_OK);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -102,7 +56,7 @@ static void ping_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_OK);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -132,7 +86,7 @@ static void func_list_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_OK);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -140,16 +94,64 @@ static void func_list_test(void **state) {
     assert_memory_equal(expected_response, response_buffer, response_size);
 }
 
-static void lookup_test(void **state) {
-    assert_int_equal(rpc_lookup_index_by_key("__funcs"), 0);
-    assert_int_equal(rpc_lookup_index_by_key("__ping"), 1);
-    assert_int_equal(rpc_lookup_index_by_key("__version"), 2);
-    assert_int_equal(rpc_lookup_index_by_key("echo"), 3);
-    assert_int_equal(rpc_lookup_index_by_key("always_error"), 4);
-    assert_int_equal(rpc_lookup_index_by_key("sum_array"), 5);
+static void schema_test(void **state) {
+    // request: {"id": 12, "func": "__schema"}
+    uint8_t request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x68, 0x5F, 0x5F, 0x73, 0x63,
+                         0x68, 0x65, 0x6D, 0x61};
 
-    assert_int_equal(rpc_lookup_index_by_key("something"), -1);
-    assert_int_equal(rpc_lookup_index_by_key("this_key_is_far_too_long"), -1);
+    // response: {"id": 12, "res": {"echo": [9], "always_error": [], "sum_array": [11]}}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x63, 0x72, 0x65, 0x73, 0xA3,
+                                   0x64, 0x65, 0x63, 0x68, 0x6F,
+                                   0x81, 0x09, 0x6C, 0x61, 0x6C,
+                                   0x77, 0x61, 0x79, 0x73, 0x5F,
+                                   0x65, 0x72, 0x72, 0x6F, 0x72,
+                                   0x80, 0x69, 0x73, 0x75, 0x6D,
+                                   0x5F, 0x61, 0x72, 0x72, 0x61,
+                                   0x79, 0x81, 0x0B};
+
+    uint8_t response_buffer[RPC___SCHEMA_MAX_RESPONSE_SIZE];
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                       &response_size, NULL);
+    assert_int_equal(err, RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+    assert_memory_equal(expected_response, response_buffer, response_size);
+
+    assert_int_equal(CBOR_TYPE_TEXT_STRING, 9);
+    assert_int_equal(CBOR_TYPE_ARRAY, 11);
+
+    // the pre-encoded result is refused as a whole when it does not fit
+    response_size = sizeof(expected_response) - 1;
+    err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer, &response_size, NULL);
+    assert_int_equal(err, RPC_ERROR_ENCODE_ERROR);
+}
+
+static void lookup_test(void **state) {
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "__funcs"), 0);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "__ping"), 1);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "__version"), 2);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "echo"), 3);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "always_error"), 4);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "sum_array"), 5);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "__compact"), 12);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "__stats"), 13);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "__schema"), 14);
+
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "something"), -1);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "this_key_is_far_too_long"), -1);
+
+    // prefixes and extensions of a key do not match it
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "ech"), -1);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, "echoo"), -1);
+    assert_int_equal(rpc_lookup_index_by_key(&rpc_dispatcher, ""), -1);
+
+    // names are not null terminated in a request
+    assert_int_equal(rpc_lookup_index_by_name(&rpc_dispatcher, "echo_and_more", 4), 3);
+    assert_int_equal(rpc_lookup_index_by_name(&rpc_dispatcher, "sum_array", 3), -1);
 }
 
 static void sum_array_test(void **state) {
@@ -170,7 +172,7 @@ static void sum_array_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_OK);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -201,7 +203,7 @@ static void sum_array_bad_types_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_ERROR_INVALID_ARGS);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -209,6 +211,104 @@ static void sum_array_bad_types_test(void **state) {
     assert_memory_equal(expected_response, response_buffer, sizeof(expected_response));
 }
 
+static void lazy_args_test(void **state) {
+    // request: {"id": 13, "func": "sum_array", "args":["a"]}
+    uint8_t wrong_type_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0D,
+                                    0x64, 0x66, 0x75, 0x6E, 0x63,
+                                    0x69, 0x73, 0x75, 0x6D, 0x5F,
+                                    0x61, 0x72, 0x72, 0x61, 0x79,
+                                    0x64, 0x61, 0x72, 0x67, 0x73,
+                                    0x81, 0x61, 0x61};
+
+    // request: {"id": 13, "func": "sum_array", "args":[]}
+    uint8_t missing_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0D,
+                                 0x64, 0x66, 0x75, 0x6E, 0x63,
+                                 0x69, 0x73, 0x75, 0x6D, 0x5F,
+                                 0x61, 0x72, 0x72, 0x61, 0x79,
+                                 0x64, 0x61, 0x72, 0x67, 0x73,
+                                 0x80};
+
+    // sequence: {"id": 13, "func": "sum_array", "args":[[1,2,3,4,5]]} {"id": 12, "func": "__ping"}
+    uint8_t batch_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0D,
+                               0x64, 0x66, 0x75, 0x6E, 0x63,
+                               0x69, 0x73, 0x75, 0x6D, 0x5F,
+                               0x61, 0x72, 0x72, 0x61, 0x79,
+                               0x64, 0x61, 0x72, 0x67, 0x73,
+                               0x81, 0x85, 0x01, 0x02, 0x03,
+                               0x04, 0x05, 0xA2, 0x62, 0x69,
+                               0x64, 0x0C, 0x64, 0x66, 0x75,
+                               0x6E, 0x63, 0x66, 0x5F, 0x5F,
+                               0x70, 0x69, 0x6E, 0x67};
+
+    // sequence: {"id": 13, "res": 15} {"id": 12, "res": "pong"}
+    uint8_t expected_batch_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0D,
+                                         0x63, 0x72, 0x65, 0x73, 0x0F,
+                                         0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                         0x63, 0x72, 0x65, 0x73, 0x64,
+                                         0x70, 0x6F, 0x6E, 0x67};
+
+    uint8_t response_buffer[128];
+    size_t response_size = sizeof(response_buffer);
+
+    // the argument type is checked by the generated stub instead of the dispatcher
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, wrong_type_request, sizeof(wrong_type_request),
+                                       response_buffer, &response_size, NULL);
+    assert_int_equal(err, RPC_ERROR_INVALID_ARGS);
+
+    // the number of arguments is still checked up front
+    response_size = sizeof(response_buffer);
+    err = execute_rpc_call(&rpc_dispatcher, missing_request, sizeof(missing_request), response_buffer,
+                           &response_size, NULL);
+    assert_int_equal(err, RPC_ERROR_INVALID_ARGS);
+
+    // a batch steps over the args the dispatcher left alone
+    response_size = sizeof(response_buffer);
+    err = execute_rpc_batch(&rpc_dispatcher, batch_request, sizeof(batch_request), response_buffer, &response_size,
+                            NULL);
+    assert_int_equal(err, RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_batch_response));
+    assert_memory_equal(expected_batch_response, response_buffer, response_size);
+}
+
+static void ping_id_encoding_test(void **state) {
+    // request: {"func": "__ping"}
+    uint8_t request_without_id[] = {0xA1, 0x64, 0x66, 0x75, 0x6E,
+                                    0x63, 0x66, 0x5F, 0x5F, 0x70,
+                                    0x69, 0x6E, 0x67};
+
+    // response: {"res": "pong"}
+    uint8_t expected_response_without_id[] = {0xA1, 0x63, 0x72, 0x65, 0x73,
+                                              0x64, 0x70, 0x6F, 0x6E, 0x67};
+
+    // request: {"id": 1000, "func": "__ping"}
+    uint8_t request_with_id[] = {0xA2, 0x62, 0x69, 0x64, 0x19,
+                                 0x03, 0xE8, 0x64, 0x66, 0x75,
+                                 0x6E, 0x63, 0x66, 0x5F, 0x5F,
+                                 0x70, 0x69, 0x6E, 0x67};
+
+    // response: {"id": 1000, "res": "pong"}
+    uint8_t expected_response_with_id[] = {0xA2, 0x62, 0x69, 0x64, 0x19,
+                                           0x03, 0xE8, 0x63, 0x72, 0x65,
+                                           0x73, 0x64, 0x70, 0x6F, 0x6E,
+                                           0x67};
+
+    uint8_t response_buffer[512];
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request_without_id,
+                                       sizeof(request_without_id), response_buffer, &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response_without_id));
+    assert_memory_equal(expected_response_without_id, response_buffer, response_size);
+
+    response_size = sizeof(response_buffer);
+    err = execute_rpc_call(&rpc_dispatcher, request_with_id, sizeof(request_with_id),
+                           response_buffer, &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response_with_id));
+    assert_memory_equal(expected_response_with_id, response_buffer, response_size);
+}
+
 static void hidden_ping_test(void **state) {
     // request: {"v": 1, "id": 12, "func": "_hidden_ping", "args":[]}
     uint8_t request[] = {0xA4, 0x61, 0x76, 0x01, 0x62,
@@ -229,7 +329,7 @@ static void hidden_ping_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_OK);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -252,7 +352,7 @@ static void ping_test_by_index(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_OK);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -275,7 +375,7 @@ static void hidden_ping_test_by_index(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_OK);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -303,7 +403,7 @@ static void invalid_index_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_ERROR_METHOD_NOT_FOUND);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -329,7 +429,33 @@ static void echo_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                       &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+}
+
+static void echo_args_first_test(void **state) {
+    // request: {"args":["cake"], "func": "echo", "id": 12}
+    uint8_t request[] = {0xA3, 0x64, 0x61, 0x72, 0x67,
+                         0x73, 0x81, 0x64, 0x63, 0x61,
+                         0x6B, 0x65, 0x64, 0x66, 0x75,
+                         0x6E, 0x63, 0x64, 0x65, 0x63,
+                         0x68, 0x6F, 0x62, 0x69, 0x64,
+                         0x0C};
+
+    // response: {"id": 12, "res": "cake"}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x63, 0x72, 0x65, 0x73, 0x64,
+                                   0x63, 0x61, 0x6B, 0x65};
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_OK);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -337,6 +463,63 @@ static void echo_test(void **state) {
     assert_memory_equal(expected_response, response_buffer, response_size);
 }
 
+static void string_view_test(void **state) {
+    // [h'010203', "cake", (_ "ca", "ke")]
+    uint8_t input[] = {0x83, 0x43, 0x01, 0x02, 0x03,
+                       0x64, 0x63, 0x61, 0x6B, 0x65,
+                       0x7F, 0x62, 0x63, 0x61, 0x62,
+                       0x6B, 0x65, 0xFF};
+
+    CborParser parser;
+    CborValue array_it, it;
+    assert_int_equal(cbor_parser_init(input, sizeof(input), 0, &parser, &array_it), CborNoError);
+    assert_int_equal(cbor_value_enter_container(&array_it, &it), CborNoError);
+
+    const uint8_t *bytes;
+    const char *text;
+    size_t length;
+
+    // both views point straight into the input
+    assert_int_equal(rpc_get_byte_string_view(&it, &bytes, &length), RPC_OK);
+    assert_ptr_equal(bytes, input + 2);
+    assert_int_equal(length, 3);
+    assert_int_equal(rpc_get_text_string_view(&it, &text, &length), RPC_ERROR_INVALID_ARGS);
+
+    assert_int_equal(cbor_value_advance(&it), CborNoError);
+    assert_int_equal(rpc_get_text_string_view(&it, &text, &length), RPC_OK);
+    assert_ptr_equal(text, (const char *) input + 6);
+    assert_int_equal(length, 4);
+
+    // a chunked string is not contiguous
+    assert_int_equal(cbor_value_advance(&it), CborNoError);
+    assert_int_equal(rpc_get_text_string_view(&it, &text, &length), RPC_ERROR_INVALID_ARGS);
+}
+
+static void missing_func_test(void **state) {
+    // request: {"id": 12}
+    uint8_t request[] = {0xA1, 0x62, 0x69, 0x64, 0x0C};
+
+    // response: {"id": 12, "err":{"c": -32600, "msg": "Invalid request"}}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x63, 0x65, 0x72, 0x72, 0xA2,
+                                   0x61, 0x63, 0x39, 0x7F, 0x57,
+                                   0x63, 0x6D, 0x73, 0x67, 0x6F,
+                                   0x49, 0x6E, 0x76, 0x61, 0x6C,
+                                   0x69, 0x64, 0x20, 0x72, 0x65,
+                                   0x71, 0x75, 0x65, 0x73, 0x74};
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                       &response_size, NULL);
+    assert_true(err == RPC_ERROR_INVALID_REQUEST);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+}
+
 static void error_test(void **state) {
     // request: {"id": 12, "func": "always_error", "args":[]}
     uint8_t request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
@@ -360,7 +543,7 @@ static void error_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_ERROR_INTERNAL_ERROR);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -392,7 +575,7 @@ static void method_not_found_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = sizeof(response_buffer);
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_ERROR_METHOD_NOT_FOUND);
     assert_int_equal(response_size, sizeof(expected_response));
@@ -413,7 +596,7 @@ static void error_buffer_too_small_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = 0;
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_ERROR_ENCODE_ERROR);
     assert_int_equal(response_size, 0);
@@ -435,17 +618,1594 @@ static void ping_response_buffer_too_small_test(void **state) {
     memset(response_buffer, 0, sizeof(response_buffer));
     size_t response_size = 10;
 
-    rpc_error_t err = execute_rpc_call(rpc_function_table, SIMPLECBORRPC_FUNCTION_COUNT, request, sizeof(request), response_buffer,
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
                                        &response_size, NULL);
     assert_true(err == RPC_ERROR_ENCODE_ERROR);
     assert_int_equal(response_size, 0);
 }
 
+static void compact_echo_test(void **state) {
+    // request: {0: 12, 1: "echo", 2: ["cake"]}
+    uint8_t request[] = {0xA3, 0x00, 0x0C, 0x01, 0x64,
+                         0x65, 0x63, 0x68, 0x6F, 0x02,
+                         0x81, 0x64, 0x63, 0x61, 0x6B,
+                         0x65};
+
+    // response: {0: 12, 3: "cake"}
+    uint8_t expected_response[] = {0xA2, 0x00, 0x0C, 0x03, 0x64,
+                                   0x63, 0x61, 0x6B, 0x65};
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                       &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+}
+
+static void compact_error_test(void **state) {
+    // request: {0: 12, 1: 4, 2: []}, always_error by index
+    uint8_t request[] = {0xA3, 0x00, 0x0C, 0x01, 0x04,
+                         0x02, 0x80};
+
+    // response: {0: 12, 4: {5: -32603, 6: "this is a test error"}}
+    uint8_t expected_response[] = {0xA2, 0x00, 0x0C, 0x04, 0xA2,
+                                   0x05, 0x39, 0x7F, 0x5A, 0x06,
+                                   0x74, 0x74, 0x68, 0x69, 0x73,
+                                   0x20, 0x69, 0x73, 0x20, 0x61,
+                                   0x20, 0x74, 0x65, 0x73, 0x74,
+                                   0x20, 0x65, 0x72, 0x72, 0x6F,
+                                   0x72};
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                       &response_size, NULL);
+    assert_true(err == RPC_ERROR_INTERNAL_ERROR);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+
+    // the message does not fit, the fallback keeps the id and the compact keys
+    // response: {0: 12, 4: {5: -32099, 6: "encode_error"}}
+    uint8_t expected_fallback[] = {0xA2, 0x00, 0x0C, 0x04, 0xA2,
+                                   0x05, 0x39, 0x7D, 0x62, 0x06,
+                                   0x6C, 0x65, 0x6E, 0x63, 0x6F,
+                                   0x64, 0x65, 0x5F, 0x65, 0x72,
+                                   0x72, 0x6F, 0x72};
+
+    memset(response_buffer, 0, sizeof(response_buffer));
+    response_size = sizeof(expected_fallback);
+
+    err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer, &response_size, NULL);
+    assert_true(err == RPC_ERROR_INTERNAL_ERROR);
+    assert_int_equal(response_size, sizeof(expected_fallback));
+
+    assert_memory_equal(expected_fallback, response_buffer, response_size);
+}
+
+static void compact_mixed_keys_test(void **state) {
+    // request: {0: 12, "func": "__ping"}
+    uint8_t request[] = {0xA2, 0x00, 0x0C, 0x64, 0x66,
+                         0x75, 0x6E, 0x63, 0x66, 0x5F,
+                         0x5F, 0x70, 0x69, 0x6E, 0x67};
+
+    // response: {0: 12, 4: {5: -32600, 6: "Invalid request"}}
+    uint8_t expected_response[] = {0xA2, 0x00, 0x0C, 0x04, 0xA2,
+                                   0x05, 0x39, 0x7F, 0x57, 0x06,
+                                   0x6F, 0x49, 0x6E, 0x76, 0x61,
+                                   0x6C, 0x69, 0x64, 0x20, 0x72,
+                                   0x65, 0x71, 0x75, 0x65, 0x73,
+                                   0x74};
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                       &response_size, NULL);
+    assert_true(err == RPC_ERROR_INVALID_REQUEST);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+}
+
+static void compact_key_map_test(void **state) {
+    // request: {"id": 12, "func": "__compact"}
+    uint8_t request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x69, 0x5F, 0x5F, 0x63, 0x6F,
+                         0x6D, 0x70, 0x61, 0x63, 0x74};
+
+    // response: {"id": 12, "res": {"id": 0, "func": 1, "args": 2, "res": 3, "err": 4, "c": 5, "msg": 6}}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x63, 0x72, 0x65, 0x73, 0xA7,
+                                   0x62, 0x69, 0x64, 0x00, 0x64,
+                                   0x66, 0x75, 0x6E, 0x63, 0x01,
+                                   0x64, 0x61, 0x72, 0x67, 0x73,
+                                   0x02, 0x63, 0x72, 0x65, 0x73,
+                                   0x03, 0x63, 0x65, 0x72, 0x72,
+                                   0x04, 0x61, 0x63, 0x05, 0x63,
+                                   0x6D, 0x73, 0x67, 0x06};
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                       &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+}
+
+static void multiple_dispatchers_test(void **state) {
+    // request: {"id": 12, "func": "add", "args": [2, 3]}
+    uint8_t add_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                             0x64, 0x66, 0x75, 0x6E, 0x63,
+                             0x63, 0x61, 0x64, 0x64, 0x64,
+                             0x61, 0x72, 0x67, 0x73, 0x82,
+                             0x02, 0x03};
+
+    // response: {"id": 12, "res": 5}
+    uint8_t expected_add_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                       0x63, 0x72, 0x65, 0x73, 0x05};
+
+    // request: {"id": 12, "func": "__funcs"}
+    uint8_t func_list_request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x64, 0x66, 0x75, 0x6E, 0x63,
+                                   0x67, 0x5F, 0x5F, 0x66, 0x75,
+                                   0x6E, 0x63, 0x73};
+
+    // response: {"id": 12, "res": {"add": 3}}
+    uint8_t expected_func_list_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                             0x63, 0x72, 0x65, 0x73, 0xA1,
+                                             0x63, 0x61, 0x64, 0x64, 0x03};
+
+    uint8_t response_buffer[512];
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&alt_dispatcher, add_request, sizeof(add_request), response_buffer,
+                                       &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_add_response));
+    assert_memory_equal(expected_add_response, response_buffer, response_size);
+
+    // __funcs lists the functions of the dispatcher it is called through
+    response_size = sizeof(response_buffer);
+    err = execute_rpc_call(&alt_dispatcher, func_list_request, sizeof(func_list_request), response_buffer,
+                           &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_func_list_response));
+    assert_memory_equal(expected_func_list_response, response_buffer, response_size);
+
+    // the other table does not know the function
+    response_size = sizeof(response_buffer);
+    err = execute_rpc_call(&rpc_dispatcher, add_request, sizeof(add_request), response_buffer, &response_size, NULL);
+    assert_true(err == RPC_ERROR_METHOD_NOT_FOUND);
+
+    assert_int_equal(rpc_lookup_index_by_key(&alt_dispatcher, "add"), 3);
+    assert_int_equal(rpc_lookup_index_by_key(&alt_dispatcher, "echo"), -1);
+}
+
+#define SERVER_STRESS_PRODUCERS 3
+#define SERVER_STRESS_REQUESTS 20000
+
+typedef struct {
+    const uint8_t *request;
+    size_t request_size;
+
+    uint8_t expected_response[64];
+    size_t expected_response_size;
+} server_stress_case_t;
+
+typedef struct {
+    rpc_server_t *server;
+    server_stress_case_t *cases;
+    size_t case_count;
+
+    size_t replies;
+    size_t mismatches;
+} server_stress_t;
+
+static server_stress_t server_stress;
+
+static void server_stress_reply(const uint8_t *response, size_t response_size, rpc_error_t result, void *reply_ptr) {
+    const server_stress_case_t *stress_case = (const server_stress_case_t *) reply_ptr;
+
+    if (response_size != stress_case->expected_response_size ||
+        memcmp(response, stress_case->expected_response, response_size) != 0) {
+        __atomic_add_fetch(&server_stress.mismatches, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&server_stress.replies, 1, __ATOMIC_RELAXED);
+}
+
+static void *server_stress_producer(void *arg) {
+    size_t offset = (size_t) arg;
+
+    for (size_t i = 0; i < SERVER_STRESS_REQUESTS; i++) {
+        server_stress_case_t *stress_case = &server_stress.cases[(i + offset) % server_stress.case_count];
+        while (!rpc_server_submit(server_stress.server, stress_case->request, stress_case->request_size,
+                                  stress_case)) {
+            sched_yield(); // queue full
+        }
+    }
+
+    return NULL;
+}
+
+static void server_stress_test(void **state) {
+    // request: {"id": 13, "func": "sum_array", "args":[[1,2,3,4,5]]}
+    static const uint8_t sum_array_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0D,
+                                                0x64, 0x66, 0x75, 0x6E, 0x63,
+                                                0x69, 0x73, 0x75, 0x6D, 0x5F,
+                                                0x61, 0x72, 0x72, 0x61, 0x79,
+                                                0x64, 0x61, 0x72, 0x67, 0x73,
+                                                0x81, 0x85, 0x01, 0x02, 0x03,
+                                                0x04, 0x05};
+
+    // request: {"id": 12, "func": "echo", "args":["cake"]}
+    static const uint8_t echo_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                                           0x64, 0x66, 0x75, 0x6E, 0x63,
+                                           0x64, 0x65, 0x63, 0x68, 0x6F,
+                                           0x64, 0x61, 0x72, 0x67, 0x73,
+                                           0x81, 0x64, 0x63, 0x61, 0x6B,
+                                           0x65};
+
+    // request: {"id": 12, "func": "always_error", "args":[]}
+    static const uint8_t error_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                                            0x64, 0x66, 0x75, 0x6E, 0x63,
+                                            0x6C, 0x61, 0x6C, 0x77, 0x61,
+                                            0x79, 0x73, 0x5F, 0x65, 0x72,
+                                            0x72, 0x6F, 0x72, 0x64, 0x61,
+                                            0x72, 0x67, 0x73, 0x80};
+
+    server_stress_case_t cases[] = {
+            {sum_array_request, sizeof(sum_array_request), {0}, 0},
+            {echo_request, sizeof(echo_request), {0}, 0},
+            {error_request, sizeof(error_request), {0}, 0},
+    };
+
+    // the single threaded responses are the reference for the concurrent ones
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        cases[i].expected_response_size = sizeof(cases[i].expected_response);
+        execute_rpc_call(&rpc_dispatcher, cases[i].request, cases[i].request_size, cases[i].expected_response,
+                         &cases[i].expected_response_size, NULL);
+        assert_true(cases[i].expected_response_size > 0);
+    }
+
+    // snapshot of everything the workers share, it has to be exactly the same afterwards
+    rpc_function_entry_t function_table[RPC_FUNCTION_COUNT];
+    memcpy(function_table, rpc_function_table, sizeof(function_table));
+    rpc_dispatcher_t dispatcher = rpc_dispatcher;
+    uint16_t salts[64], graph[64];
+    uint8_t key_lengths[RPC_FUNCTION_COUNT];
+    assert_true(rpc_dispatcher.salt_size * 2 <= 64 && rpc_dispatcher.graph_size <= 64);
+    memcpy(salts, rpc_dispatcher.salts, rpc_dispatcher.salt_size * 2 * sizeof(uint16_t));
+    memcpy(graph, rpc_dispatcher.graph, rpc_dispatcher.graph_size * sizeof(uint16_t));
+    memcpy(key_lengths, rpc_dispatcher.key_lengths, sizeof(key_lengths));
+
+    rpc_server_config_t config = {&rpc_dispatcher, 4, 64, 64, 128, server_stress_reply, NULL};
+    server_stress.server = rpc_server_create(&config);
+    assert_non_null(server_stress.server);
+    server_stress.cases = cases;
+    server_stress.case_count = sizeof(cases) / sizeof(cases[0]);
+    server_stress.replies = 0;
+    server_stress.mismatches = 0;
+
+    pthread_t producers[SERVER_STRESS_PRODUCERS];
+    for (size_t i = 0; i < SERVER_STRESS_PRODUCERS; i++) {
+        assert_int_equal(pthread_create(&producers[i], NULL, server_stress_producer, (void *) i), 0);
+    }
+
+    for (size_t i = 0; i < SERVER_STRESS_PRODUCERS; i++) pthread_join(producers[i], NULL);
+
+    // drains the queue before returning
+    rpc_server_destroy(server_stress.server);
+
+    assert_int_equal(server_stress.replies, SERVER_STRESS_PRODUCERS * SERVER_STRESS_REQUESTS);
+    assert_int_equal(server_stress.mismatches, 0);
+
+    assert_memory_equal(function_table, rpc_function_table, sizeof(function_table));
+    assert_memory_equal(&dispatcher, &rpc_dispatcher, sizeof(dispatcher));
+    assert_memory_equal(salts, rpc_dispatcher.salts, rpc_dispatcher.salt_size * 2 * sizeof(uint16_t));
+    assert_memory_equal(graph, rpc_dispatcher.graph, rpc_dispatcher.graph_size * sizeof(uint16_t));
+    assert_memory_equal(key_lengths, rpc_dispatcher.key_lengths, sizeof(key_lengths));
+}
+
+static void server_create_overflow_test(void **state) {
+    // queue_size * max_request_size
+    rpc_server_config_t config = {&rpc_dispatcher, 1, 4, SIZE_MAX / 2, 128, server_stress_reply, NULL};
+    assert_null(rpc_server_create(&config));
+
+    // max_request_size + max_response_size
+    config = (rpc_server_config_t) {&rpc_dispatcher, 1, 1, SIZE_MAX, 1, server_stress_reply, NULL};
+    assert_null(rpc_server_create(&config));
+
+    // worker_count * (max_request_size + max_response_size)
+    config = (rpc_server_config_t) {&rpc_dispatcher, SIZE_MAX / 64, 1, 64, 64, server_stress_reply, NULL};
+    assert_null(rpc_server_create(&config));
+
+    // the sum of the slots and the arenas
+    config = (rpc_server_config_t) {&rpc_dispatcher, 1, 1, SIZE_MAX / 2, SIZE_MAX / 2, server_stress_reply, NULL};
+    assert_null(rpc_server_create(&config));
+
+    // rounding the queue size up to a power of two
+    config = (rpc_server_config_t) {&rpc_dispatcher, 1, SIZE_MAX, 1, 1, server_stress_reply, NULL};
+    assert_null(rpc_server_create(&config));
+}
+
+static void max_response_size_test(void **state) {
+    // request: {"id": 0xFFFFFFFFFFFFFFFF, "func": "echo", "args": ["aaa...a"]} with the longest string echo accepts
+    char text[64];
+    memset(text, 'a', sizeof(text));
+
+    uint8_t request[128];
+    CborEncoder encoder, map_encoder, array_encoder;
+    cbor_encoder_init(&encoder, request, sizeof(request), 0);
+    cbor_encoder_create_map(&encoder, &map_encoder, 3);
+    cbor_encode_text_stringz(&map_encoder, "id");
+    cbor_encode_uint(&map_encoder, UINT64_MAX);
+    cbor_encode_text_stringz(&map_encoder, "func");
+    cbor_encode_text_stringz(&map_encoder, "echo");
+    cbor_encode_text_stringz(&map_encoder, "args");
+    cbor_encoder_create_array(&map_encoder, &array_encoder, 1);
+    cbor_encode_text_string(&array_encoder, text, sizeof(text));
+    cbor_encoder_close_container(&map_encoder, &array_encoder);
+    assert_true(cbor_encoder_close_container(&encoder, &map_encoder) == CborNoError);
+    size_t request_size = cbor_encoder_get_buffer_size(&encoder, request);
+
+    // the response fills the buffer exactly
+    uint8_t response_buffer[RPC_ECHO_MAX_RESPONSE_SIZE];
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, request_size,
+                                       response_buffer, &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, RPC_ECHO_MAX_RESPONSE_SIZE);
+}
+
+static void max_error_response_size_test(void **state) {
+    // request: {"id": 0xFFFFFFFFFFFFFFFF, "func": "missing_function", "args":[]}
+    uint8_t request[] = {0xA3, 0x62, 0x69, 0x64, 0x1B,
+                         0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                         0xFF, 0xFF, 0xFF, 0x64, 0x66,
+                         0x75, 0x6E, 0x63, 0x70, 0x6D,
+                         0x69, 0x73, 0x73, 0x69, 0x6E,
+                         0x67, 0x5F, 0x66, 0x75, 0x6E,
+                         0x63, 0x74, 0x69, 0x6F, 0x6E,
+                         0x64, 0x61, 0x72, 0x67, 0x73,
+                         0x80};
+
+    // response: {"id": 0xFFFFFFFFFFFFFFFF, "err": {"c": -32601, "msg": "Method not found"}}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x1B,
+                                   0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                   0xFF, 0xFF, 0xFF, 0x63, 0x65,
+                                   0x72, 0x72, 0xA2, 0x61, 0x63,
+                                   0x39, 0x7F, 0x58, 0x63, 0x6D,
+                                   0x73, 0x67, 0x70, 0x4D, 0x65,
+                                   0x74, 0x68, 0x6F, 0x64, 0x20,
+                                   0x6E, 0x6F, 0x74, 0x20, 0x66,
+                                   0x6F, 0x75, 0x6E, 0x64};
+
+    // error responses always fit in the size generated for a function
+    uint8_t response_buffer[RPC_SUM_ARRAY_MAX_RESPONSE_SIZE];
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request),
+                                       response_buffer, &response_size, NULL);
+    assert_true(err == RPC_ERROR_METHOD_NOT_FOUND);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+}
+
+static void batch_array_test(void **state) {
+    // request: [{"id": 12, "func": "__ping"}, {"id": 13, "func": "echo", "args":["cake"]}, {"id": 14, "func": "missing"}]
+    uint8_t request[] = {0x83, 0xA2, 0x62, 0x69, 0x64,
+                         0x0C, 0x64, 0x66, 0x75, 0x6E,
+                         0x63, 0x66, 0x5F, 0x5F, 0x70,
+                         0x69, 0x6E, 0x67, 0xA3, 0x62,
+                         0x69, 0x64, 0x0D, 0x64, 0x66,
+                         0x75, 0x6E, 0x63, 0x64, 0x65,
+                         0x63, 0x68, 0x6F, 0x64, 0x61,
+                         0x72, 0x67, 0x73, 0x81, 0x64,
+                         0x63, 0x61, 0x6B, 0x65, 0xA2,
+                         0x62, 0x69, 0x64, 0x0E, 0x64,
+                         0x66, 0x75, 0x6E, 0x63, 0x67,
+                         0x6D, 0x69, 0x73, 0x73, 0x69,
+                         0x6E, 0x67};
+
+    // response: [{"id": 12, "res": "pong"}, {"id": 13, "res": "cake"},
+    //            {"id": 14, "err":{"c": -32601, "msg": "Method not found"}}]
+    uint8_t expected_response[] = {0x83, 0xA2, 0x62, 0x69, 0x64,
+                                   0x0C, 0x63, 0x72, 0x65, 0x73,
+                                   0x64, 0x70, 0x6F, 0x6E, 0x67,
+                                   0xA2, 0x62, 0x69, 0x64, 0x0D,
+                                   0x63, 0x72, 0x65, 0x73, 0x64,
+                                   0x63, 0x61, 0x6B, 0x65, 0xA2,
+                                   0x62, 0x69, 0x64, 0x0E, 0x63,
+                                   0x65, 0x72, 0x72, 0xA2, 0x61,
+                                   0x63, 0x39, 0x7F, 0x58, 0x63,
+                                   0x6D, 0x73, 0x67, 0x70, 0x4D,
+                                   0x65, 0x74, 0x68, 0x6F, 0x64,
+                                   0x20, 0x6E, 0x6F, 0x74, 0x20,
+                                   0x66, 0x6F, 0x75, 0x6E, 0x64};
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_batch(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                        &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+}
+
+static void batch_sequence_test(void **state) {
+    // request: {"id": 12, "func": "__ping"} {"func": "__version"}
+    uint8_t request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x66, 0x5F, 0x5F, 0x70, 0x69,
+                         0x6E, 0x67, 0xA1, 0x64, 0x66,
+                         0x75, 0x6E, 0x63, 0x69, 0x5F,
+                         0x5F, 0x76, 0x65, 0x72, 0x73,
+                         0x69, 0x6F, 0x6E};
+
+    // response: {"id": 12, "res": "pong"} {"res": 1}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x63, 0x72, 0x65, 0x73, 0x64,
+                                   0x70, 0x6F, 0x6E, 0x67, 0xA1,
+                                   0x63, 0x72, 0x65, 0x73, 0x01};
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_batch(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                        &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, response_size);
+}
+
+typedef struct {
+    uint8_t data[512];
+    size_t size;
+    size_t flush_count;
+} stream_capture_t;
+
+static bool capture_flush(const uint8_t *data, size_t size, void *flush_ptr) {
+    stream_capture_t *capture = (stream_capture_t *) flush_ptr;
+    if (capture->size + size > sizeof(capture->data)) return false;
+
+    memcpy(capture->data + capture->size, data, size);
+    capture->size += size;
+    capture->flush_count++;
+    return true;
+}
+
+static void streaming_func_list_test(void **state) {
+    // request: {"id": 12, "func": "__funcs"}
+    uint8_t request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x67, 0x5F, 0x5F, 0x66, 0x75,
+                         0x6E, 0x63, 0x73};
+
+    // response: {"id": 12, "res":{"echo": 3, "always_error": 4, "sum_array": 5}}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x63, 0x72, 0x65, 0x73, 0xA3,
+                                   0x64, 0x65, 0x63, 0x68, 0x6F,
+                                   0x03, 0x6C, 0x61, 0x6C, 0x77,
+                                   0x61, 0x79, 0x73, 0x5F, 0x65,
+                                   0x72, 0x72, 0x6F, 0x72, 0x04,
+                                   0x69, 0x73, 0x75, 0x6D, 0x5F,
+                                   0x61, 0x72, 0x72, 0x61, 0x79,
+                                   0x05};
+
+    uint8_t chunk_buffer[8];
+    stream_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+
+    rpc_error_t err = execute_rpc_call_streaming(&rpc_dispatcher, request, sizeof(request),
+                                                 chunk_buffer, sizeof(chunk_buffer), capture_flush, &capture, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(capture.size, sizeof(expected_response));
+    assert_int_equal(capture.flush_count, (sizeof(expected_response) + sizeof(chunk_buffer) - 1) / sizeof(chunk_buffer));
+
+    assert_memory_equal(expected_response, capture.data, capture.size);
+}
+
+static void streaming_error_test(void **state) {
+    // request: {"id": 12, "func": "always_error", "args":[]}
+    uint8_t request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x6C, 0x61, 0x6C, 0x77, 0x61,
+                         0x79, 0x73, 0x5F, 0x65, 0x72,
+                         0x72, 0x6F, 0x72, 0x64, 0x61,
+                         0x72, 0x67, 0x73, 0x80};
+
+    // response: {"id": 12, "err":{"c": -32603, "msg": "this is a test error"}}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x63, 0x65, 0x72, 0x72, 0xA2,
+                                   0x61, 0x63, 0x39, 0x7F, 0x5A,
+                                   0x63, 0x6D, 0x73, 0x67, 0x74,
+                                   0x74, 0x68, 0x69, 0x73, 0x20,
+                                   0x69, 0x73, 0x20, 0x61, 0x20,
+                                   0x74, 0x65, 0x73, 0x74, 0x20,
+                                   0x65, 0x72, 0x72, 0x6F, 0x72};
+
+    uint8_t chunk_buffer[16];
+    stream_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+
+    rpc_error_t err = execute_rpc_call_streaming(&rpc_dispatcher, request, sizeof(request),
+                                                 chunk_buffer, sizeof(chunk_buffer), capture_flush, &capture, NULL);
+    assert_true(err == RPC_ERROR_INTERNAL_ERROR);
+    assert_int_equal(capture.size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, capture.data, capture.size);
+}
+
+static void byte_string_reference_test(void **state) {
+    // request: {"id": 12, "func": "_read_blob"}
+    uint8_t request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x6A, 0x5F, 0x72, 0x65, 0x61,
+                         0x64, 0x5F, 0x62, 0x6C, 0x6F,
+                         0x62};
+
+    // response: {"id": 12, "res": h'...'} with a 4096 byte string, up to its header
+    uint8_t expected_header[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                 0x63, 0x72, 0x65, 0x73, 0x59,
+                                 0x10, 0x00};
+
+    static uint8_t payload[4096];
+    for (size_t i = 0; i < sizeof(payload); i++) payload[i] = (uint8_t) i;
+    rpc_iovec_t blob = {payload, sizeof(payload)};
+
+    // the payload is sent from where it is, the buffer only holds the framing
+    uint8_t response_buffer[32];
+    rpc_iovec_t iov[RPC_IOV_MAX];
+    size_t iov_count = 0;
+
+    rpc_error_t err = execute_rpc_call_iov(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                           sizeof(response_buffer), iov, &iov_count, &blob);
+    assert_int_equal(err, RPC_OK);
+    assert_int_equal(iov_count, 2);
+    assert_ptr_equal(iov[0].data, response_buffer);
+    assert_int_equal(iov[0].size, sizeof(expected_header));
+    assert_memory_equal(expected_header, response_buffer, sizeof(expected_header));
+    assert_ptr_equal(iov[1].data, payload);
+    assert_int_equal(iov[1].size, sizeof(payload));
+
+    // execute_rpc_call copies it
+    static uint8_t copy_buffer[sizeof(expected_header) + sizeof(payload)];
+    size_t response_size = sizeof(copy_buffer);
+    err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), copy_buffer, &response_size, &blob);
+    assert_int_equal(err, RPC_OK);
+    assert_int_equal(response_size, sizeof(copy_buffer));
+    assert_memory_equal(expected_header, copy_buffer, sizeof(expected_header));
+    assert_memory_equal(payload, copy_buffer + sizeof(expected_header), sizeof(payload));
+
+    // responses that do not reference anything come back as one piece
+    uint8_t ping_request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                              0x64, 0x66, 0x75, 0x6E, 0x63,
+                              0x66, 0x5F, 0x5F, 0x70, 0x69,
+                              0x6E, 0x67};
+
+    err = execute_rpc_call_iov(&rpc_dispatcher, ping_request, sizeof(ping_request), response_buffer,
+                               sizeof(response_buffer), iov, &iov_count, NULL);
+    assert_int_equal(err, RPC_OK);
+    assert_int_equal(iov_count, 1);
+    assert_int_equal(iov[0].size, 14);
+}
+
+static rpc_error_t deferred_pong(CborEncoder *result, const char **error_msg, void *complete_ptr) {
+    cbor_encode_text_stringz(result, "pong");
+
+    return RPC_OK;
+}
+
+static void deferred_call_test(void **state) {
+    // request: {"id": 12, "func": "_deferred_ping"}
+    uint8_t request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x6E, 0x5F, 0x64, 0x65, 0x66,
+                         0x65, 0x72, 0x72, 0x65, 0x64,
+                         0x5F, 0x70, 0x69, 0x6E, 0x67};
+
+    // response: {"id": 12, "res": "pong"}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                                   0x63, 0x72, 0x65, 0x73, 0x64,
+                                   0x70, 0x6F, 0x6E, 0x67};
+
+    uint8_t response_buffer[512];
+    size_t response_size = sizeof(response_buffer);
+    rpc_deferred_t token;
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer, &response_size,
+                                       &token);
+    assert_int_equal(err, RPC_PENDING);
+    assert_int_equal(response_size, 0);
+    assert_int_equal(token.transaction_id, 12);
+
+    // answered later, from the token alone
+    response_size = sizeof(response_buffer);
+    err = rpc_complete(&token, deferred_pong, NULL, response_buffer, &response_size);
+    assert_int_equal(err, RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+    assert_memory_equal(expected_response, response_buffer, sizeof(expected_response));
+}
+
+static void deferred_batch_test(void **state) {
+    // request sequence: {"id": 1, "func": "_deferred_ping"} {"id": 2, "func": "__ping"}
+    uint8_t sequence_request[] = {0xA2, 0x62, 0x69, 0x64, 0x01,
+                                  0x64, 0x66, 0x75, 0x6E, 0x63,
+                                  0x6E, 0x5F, 0x64, 0x65, 0x66,
+                                  0x65, 0x72, 0x72, 0x65, 0x64,
+                                  0x5F, 0x70, 0x69, 0x6E, 0x67,
+                                  0xA2, 0x62, 0x69, 0x64, 0x02,
+                                  0x64, 0x66, 0x75, 0x6E, 0x63,
+                                  0x66, 0x5F, 0x5F, 0x70, 0x69,
+                                  0x6E, 0x67};
+
+    // response sequence: {"id": 2, "res": "pong"}, the deferred call is answered separately
+    uint8_t expected_sequence_response[] = {0xA2, 0x62, 0x69, 0x64, 0x02,
+                                            0x63, 0x72, 0x65, 0x73, 0x64,
+                                            0x70, 0x6F, 0x6E, 0x67};
+
+    // request array: [{"id": 1, "func": "_deferred_ping"}]
+    uint8_t array_request[] = {0x81, 0xA2, 0x62, 0x69, 0x64,
+                               0x01, 0x64, 0x66, 0x75, 0x6E,
+                               0x63, 0x6E, 0x5F, 0x64, 0x65,
+                               0x66, 0x65, 0x72, 0x72, 0x65,
+                               0x64, 0x5F, 0x70, 0x69, 0x6E,
+                               0x67};
+
+    // response array: [{"id": 1, "err": {"c": -32603, "msg": "Internal error"}}]
+    uint8_t expected_array_response[] = {0x81, 0xA2, 0x62, 0x69, 0x64,
+                                         0x01, 0x63, 0x65, 0x72, 0x72,
+                                         0xA2, 0x61, 0x63, 0x39, 0x7F,
+                                         0x5A, 0x63, 0x6D, 0x73, 0x67,
+                                         0x6E, 0x49, 0x6E, 0x74, 0x65,
+                                         0x72, 0x6E, 0x61, 0x6C, 0x20,
+                                         0x65, 0x72, 0x72, 0x6F, 0x72};
+
+    uint8_t response_buffer[512];
+    size_t response_size = sizeof(response_buffer);
+    rpc_deferred_t token = {0, false};
+
+    rpc_error_t err = execute_rpc_batch(&rpc_dispatcher, sequence_request, sizeof(sequence_request), response_buffer,
+                                        &response_size, &token);
+    assert_int_equal(err, RPC_OK);
+    assert_int_equal(token.transaction_id, 1);
+    assert_int_equal(response_size, sizeof(expected_sequence_response));
+    assert_memory_equal(expected_sequence_response, response_buffer, sizeof(expected_sequence_response));
+
+    // the number of responses in an array is fixed, so its entries can not be deferred
+    response_size = sizeof(response_buffer);
+    err = execute_rpc_batch(&rpc_dispatcher, array_request, sizeof(array_request), response_buffer, &response_size,
+                            &token);
+    assert_int_equal(err, RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_array_response));
+    assert_memory_equal(expected_array_response, response_buffer, sizeof(expected_array_response));
+}
+
+static void session_window_test(void **state) {
+    // request: {"id": 1, "func": "_session_ping"}, the id is changed for every call
+    uint8_t request[] = {0xA2, 0x62, 0x69, 0x64, 0x01,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x6D, 0x5F, 0x73, 0x65, 0x73,
+                         0x73, 0x69, 0x6F, 0x6E, 0x5F,
+                         0x70, 0x69, 0x6E, 0x67};
+
+    // response: {"id": 3, "err": {"c": -32002, "msg": "Too many requests in flight"}}
+    uint8_t expected_busy_response[] = {0xA2, 0x62, 0x69, 0x64, 0x03,
+                                        0x63, 0x65, 0x72, 0x72, 0xA2,
+                                        0x61, 0x63, 0x39, 0x7D, 0x01,
+                                        0x63, 0x6D, 0x73, 0x67, 0x78,
+                                        0x1B, 0x54, 0x6F, 0x6F, 0x20,
+                                        0x6D, 0x61, 0x6E, 0x79, 0x20,
+                                        0x72, 0x65, 0x71, 0x75, 0x65,
+                                        0x73, 0x74, 0x73, 0x20, 0x69,
+                                        0x6E, 0x20, 0x66, 0x6C, 0x69,
+                                        0x67, 0x68, 0x74};
+
+    // response: {"id": 2, "res": "pong"}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x02,
+                                   0x63, 0x72, 0x65, 0x73, 0x64,
+                                   0x70, 0x6F, 0x6E, 0x67};
+
+    rpc_session_slot_t slots[2];
+    rpc_session_t session;
+    rpc_session_init(&session, slots, 2);
+
+    uint8_t response_buffer[512];
+    size_t response_size;
+
+    for (uint8_t id = 1; id <= 2; id++) {
+        request[4] = id;
+        response_size = sizeof(response_buffer);
+        assert_int_equal(execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer,
+                                          &response_size, &session), RPC_PENDING);
+    }
+    assert_int_equal(rpc_session_get_in_flight(&session), 2);
+
+    // the window is full
+    request[4] = 3;
+    response_size = sizeof(response_buffer);
+    assert_int_equal(execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer, &response_size,
+                                      &session), RPC_ERROR_TOO_MANY_REQUESTS);
+    assert_int_equal(response_size, sizeof(expected_busy_response));
+    assert_memory_equal(expected_busy_response, response_buffer, sizeof(expected_busy_response));
+
+    // an id that is still outstanding can not be reused
+    request[4] = 1;
+    response_size = sizeof(response_buffer);
+    assert_int_equal(execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer, &response_size,
+                                      &session), RPC_ERROR_INVALID_REQUEST);
+
+    // the second call completes first and makes room for the third
+    rpc_session_handle_t handle = rpc_session_find(&session, 2);
+    assert_int_not_equal(handle, RPC_SESSION_NO_SLOT);
+
+    response_size = sizeof(response_buffer);
+    assert_int_equal(rpc_session_complete(&session, handle, deferred_pong, NULL, response_buffer, &response_size),
+                     RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+    assert_memory_equal(expected_response, response_buffer, sizeof(expected_response));
+    assert_int_equal(rpc_session_find(&session, 2), RPC_SESSION_NO_SLOT);
+
+    // a call is answered once, completing it again or a slot outside the window changes nothing
+    response_size = sizeof(response_buffer);
+    assert_int_equal(rpc_session_complete(&session, handle, deferred_pong, NULL, response_buffer, &response_size),
+                     RPC_ERROR_INVALID_ARGS);
+    assert_int_equal(rpc_session_complete(&session, 2, deferred_pong, NULL, response_buffer, &response_size),
+                     RPC_ERROR_INVALID_ARGS);
+    assert_int_equal(rpc_session_get_in_flight(&session), 1);
+
+    request[4] = 3;
+    response_size = sizeof(response_buffer);
+    assert_int_equal(execute_rpc_call(&rpc_dispatcher, request, sizeof(request), response_buffer, &response_size,
+                                      &session), RPC_PENDING);
+    assert_int_equal(rpc_session_get_in_flight(&session), 2);
+    assert_int_not_equal(rpc_session_find(&session, 1), RPC_SESSION_NO_SLOT);
+
+    // the third call took the slot of the second one, the stale handle of the second call does not complete it
+    rpc_session_handle_t third = rpc_session_find(&session, 3);
+    assert_int_not_equal(third, RPC_SESSION_NO_SLOT);
+    assert_int_equal(third & UINT32_MAX, handle & UINT32_MAX);
+    assert_int_not_equal(third, handle);
+
+    response_size = sizeof(response_buffer);
+    assert_int_equal(rpc_session_complete(&session, handle, deferred_pong, NULL, response_buffer, &response_size),
+                     RPC_ERROR_INVALID_ARGS);
+    assert_int_equal(rpc_session_get_in_flight(&session), 2);
+    assert_int_equal(rpc_session_find(&session, 3), third);
+
+    response_size = sizeof(response_buffer);
+    assert_int_equal(rpc_session_complete(&session, third, deferred_pong, NULL, response_buffer, &response_size),
+                     RPC_OK);
+    assert_int_equal(rpc_session_get_in_flight(&session), 1);
+}
+
+static void stats_test(void **state) {
+    // request: {"id": 12, "func": "always_error", "args":[]}
+    uint8_t error_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                               0x64, 0x66, 0x75, 0x6E, 0x63,
+                               0x6C, 0x61, 0x6C, 0x77, 0x61,
+                               0x79, 0x73, 0x5F, 0x65, 0x72,
+                               0x72, 0x6F, 0x72, 0x64, 0x61,
+                               0x72, 0x67, 0x73, 0x80};
+
+    // request: {"id": 12, "func": "__stats"}
+    uint8_t stats_request[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                               0x64, 0x66, 0x75, 0x6E, 0x63,
+                               0x67, 0x5F, 0x5F, 0x73, 0x74,
+                               0x61, 0x74, 0x73};
+
+    // the counters are shared with every other test, only what this test adds is checked
+    const rpc_stats_t *stats = rpc_dispatcher.stats;
+    const rpc_function_stats_t *function = &stats->functions[rpc_lookup_index_by_key(&rpc_dispatcher, "always_error")];
+    const uint32_t calls = function->calls;
+    const uint32_t errors = function->errors;
+    const uint32_t internal_errors = stats->errors[7];
+    const uint64_t request_bytes = stats->request_bytes;
+
+    uint8_t response_buffer[2048];
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, error_request, sizeof(error_request), response_buffer,
+                                       &response_size, NULL);
+    assert_int_equal(err, RPC_ERROR_INTERNAL_ERROR);
+
+    assert_int_equal(rpc_stats_error_codes[7], RPC_ERROR_INTERNAL_ERROR);
+    assert_int_equal(function->calls, calls + 1);
+    assert_int_equal(function->errors, errors + 1);
+    assert_int_equal(stats->errors[7], internal_errors + 1);
+    assert_int_equal(stats->request_bytes, request_bytes + sizeof(error_request));
+
+    // response: {"id": 12, "res": {"bytes": [..], "errors": {..}, "phases": {..}, "functions": {..}}}
+    response_size = sizeof(response_buffer);
+    err = execute_rpc_call(&rpc_dispatcher, stats_request, sizeof(stats_request), response_buffer, &response_size,
+                           NULL);
+    assert_int_equal(err, RPC_OK);
+    assert_true(response_size <= RPC___STATS_MAX_RESPONSE_SIZE);
+
+    CborParser parser;
+    CborValue it, result, functions, entry, value;
+    assert_int_equal(cbor_parser_init(response_buffer, response_size, 0, &parser, &it), CborNoError);
+    assert_int_equal(cbor_value_map_find_value(&it, "res", &result), CborNoError);
+    assert_true(cbor_value_is_map(&result));
+
+    size_t length;
+    assert_int_equal(cbor_value_get_map_length(&result, &length), CborNoError);
+    assert_int_equal(length, 4);
+
+    assert_int_equal(cbor_value_map_find_value(&result, "functions", &functions), CborNoError);
+    assert_int_equal(cbor_value_map_find_value(&functions, "always_error", &entry), CborNoError);
+    assert_true(cbor_value_is_array(&entry));
+
+    // [calls, errors, latency histogram]
+    uint64_t count;
+    assert_int_equal(cbor_value_enter_container(&entry, &value), CborNoError);
+    assert_int_equal(cbor_value_get_uint64(&value, &count), CborNoError);
+    assert_int_equal(count, calls + 1);
+    assert_int_equal(cbor_value_advance(&value), CborNoError);
+    assert_int_equal(cbor_value_get_uint64(&value, &count), CborNoError);
+    assert_int_equal(count, errors + 1);
+    assert_int_equal(cbor_value_advance(&value), CborNoError);
+    assert_true(cbor_value_is_array(&value));
+
+    // __stats itself is only counted once it has returned
+    assert_int_equal(stats->functions[rpc_lookup_index_by_key(&rpc_dispatcher, "__stats")].calls, 1);
+
+    // the table wide bound of a table whose functions all have a known size covers __stats as well
+    response_size = sizeof(response_buffer);
+    err = execute_rpc_call(&alt_dispatcher, stats_request, sizeof(stats_request), response_buffer, &response_size,
+                           NULL);
+    assert_int_equal(err, RPC_OK);
+    assert_true(ALT___STATS_MAX_RESPONSE_SIZE <= ALT_MAX_RESPONSE_SIZE);
+    assert_true(response_size <= ALT_MAX_RESPONSE_SIZE);
+    assert_true(ALT_MAX_RESPONSE_SIZE <= sizeof(response_buffer));
+}
+
+static void client_request_test(void **state) {
+    // request: {"id": 13, "func": 5, "args":[[1,2,3,4,5]]}
+    uint8_t expected_request[] = {0xA3, 0x62, 0x69, 0x64, 0x0D,
+                                  0x64, 0x66, 0x75, 0x6E, 0x63,
+                                  0x05, 0x64, 0x61, 0x72, 0x67,
+                                  0x73, 0x81, 0x85, 0x01, 0x02,
+                                  0x03, 0x04, 0x05};
+
+    // [1,2,3,4,5], arrays are passed already encoded
+    uint8_t values[] = {0x85, 0x01, 0x02, 0x03, 0x04,
+                        0x05};
+
+    uint8_t request[64];
+    uint8_t response[128];
+    rpc_client_response_t decoded;
+
+    size_t request_size = rpc_client_sum_array(request, sizeof(request), 13, values, sizeof(values));
+    assert_int_equal(request_size, sizeof(expected_request));
+    assert_memory_equal(expected_request, request, request_size);
+
+    size_t response_size = sizeof(response);
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, request, request_size, response, &response_size, NULL);
+    assert_int_equal(err, RPC_OK);
+
+    int64_t sum;
+    assert_int_equal(rpc_client_decode_response(&decoded, response, response_size), RPC_OK);
+    assert_int_equal(decoded.transaction_id, 13);
+    assert_int_equal(decoded.error, RPC_OK);
+    assert_int_equal(cbor_value_get_int64(&decoded.result, &sum), CborNoError);
+    assert_int_equal(sum, 15);
+
+    // the result is read where it is in the response
+    request_size = rpc_client_echo(request, sizeof(request), 12, "hello", 5);
+    response_size = sizeof(response);
+    err = execute_rpc_call(&rpc_dispatcher, request, request_size, response, &response_size, NULL);
+    assert_int_equal(err, RPC_OK);
+
+    const char *text;
+    size_t text_length;
+    assert_int_equal(rpc_client_decode_response(&decoded, response, response_size), RPC_OK);
+    assert_int_equal(rpc_get_text_string_view(&decoded.result, &text, &text_length), RPC_OK);
+    assert_int_equal(text_length, 5);
+    assert_memory_equal(text, "hello", 5);
+    assert_true(text > (const char *) response && text < (const char *) response + response_size);
+
+    // error responses
+    request_size = rpc_client_always_error(request, sizeof(request), 12);
+    response_size = sizeof(response);
+    execute_rpc_call(&rpc_dispatcher, request, request_size, response, &response_size, NULL);
+
+    assert_int_equal(rpc_client_decode_response(&decoded, response, response_size), RPC_OK);
+    assert_int_equal(decoded.transaction_id, 12);
+    assert_int_equal(decoded.error, RPC_ERROR_INTERNAL_ERROR);
+    assert_int_equal(decoded.error_msg_length, 20);
+    assert_memory_equal(decoded.error_msg, "this is a test error", 20);
+
+    // requests that do not fit are not written at all
+    assert_int_equal(rpc_client_sum_array(request, sizeof(expected_request) - 1, 13, values, sizeof(values)), 0);
+    assert_int_equal(rpc_client_echo(request, 8, 12, "hello", 5), 0);
+
+    // the index is the one of the table the encoder was generated from
+    request_size = alt_client_add(request, sizeof(request), 7, 2, 3);
+    response_size = sizeof(response);
+    err = execute_rpc_call(&alt_dispatcher, request, request_size, response, &response_size, NULL);
+    assert_int_equal(err, RPC_OK);
+
+    assert_int_equal(rpc_client_decode_response(&decoded, response, response_size), RPC_OK);
+    assert_int_equal(cbor_value_get_int64(&decoded.result, &sum), CborNoError);
+    assert_int_equal(sum, 5);
+
+    // 2^63 is an integer, but does not fit the int64_t of the typed argument and must not wrap around
+    rpc_client_request_t encoder;
+    rpc_client_request_init(&encoder, request, sizeof(request), 8, rpc_lookup_index_by_key(&alt_dispatcher, "add"), 2);
+    cbor_encode_uint(&encoder.args, (uint64_t) 1 << 63);
+    cbor_encode_int(&encoder.args, 1);
+    request_size = rpc_client_request_finish(&encoder);
+
+    response_size = sizeof(response);
+    err = execute_rpc_call(&alt_dispatcher, request, request_size, response, &response_size, NULL);
+    assert_int_equal(err, RPC_ERROR_INVALID_ARGS);
+
+    assert_int_equal(rpc_client_decode_response(&decoded, values, sizeof(values)), RPC_ERROR_PARSE_ERROR);
+}
+
+static uint64_t cached_call(uint64_t transaction_id, uint64_t value, size_t *calls) {
+    uint8_t request[32];
+    uint8_t response[32];
+    rpc_client_response_t decoded;
+    uint64_t result;
+
+    size_t request_size = rpc_client__cached_calls(request, sizeof(request), transaction_id, value);
+    size_t response_size = sizeof(response);
+    assert_int_equal(execute_rpc_call(&rpc_dispatcher, request, request_size, response, &response_size, calls),
+                     RPC_OK);
+
+    assert_int_equal(rpc_client_decode_response(&decoded, response, response_size), RPC_OK);
+    assert_int_equal(decoded.transaction_id, transaction_id);
+    assert_int_equal(cbor_value_get_uint64(&decoded.result, &result), CborNoError);
+    return result;
+}
+
+// counts its calls at user_ptr like _cached_calls, but invalidates the cache while it runs
+static rpc_error_t
+invalidating_calls(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    size_t *calls = (size_t *) user_ptr;
+    (*calls)++;
+    rpc_cache_invalidate_all(&rpc_dispatcher);
+
+    if (cbor_encode_uint(result, *calls) != CborNoError) return RPC_ERROR_ENCODE_ERROR;
+
+    return RPC_OK;
+}
+
+static void response_cache_test(void **state) {
+    const size_t index = rpc_lookup_index_by_key(&rpc_dispatcher, "_cached_calls");
+    size_t calls = 0;
+
+    assert_int_equal(cached_call(1, 1, &calls), 1);
+    assert_int_equal(cached_call(2, 1, &calls), 1);
+    assert_int_equal(calls, 1);
+
+    // other arguments are another key
+    assert_int_equal(cached_call(3, 2, &calls), 2);
+    assert_int_equal(cached_call(4, 1, &calls), 1);
+    assert_int_equal(cached_call(5, 2, &calls), 2);
+    assert_int_equal(calls, 2);
+
+    rpc_cache_invalidate(&rpc_dispatcher, index);
+    assert_int_equal(cached_call(6, 1, &calls), 3);
+    assert_int_equal(cached_call(7, 2, &calls), 4);
+    assert_int_equal(cached_call(8, 1, &calls), 3);
+
+    rpc_cache_invalidate_all(&rpc_dispatcher);
+    assert_int_equal(cached_call(9, 1, &calls), 5);
+    assert_int_equal(calls, 5);
+
+    // request: {"id": 1, "func": "stale", "args": [1]}
+    uint8_t stale_request[] = {0xA3, 0x62, 0x69, 0x64, 0x01,
+                               0x64, 0x66, 0x75, 0x6E, 0x63,
+                               0x65, 0x73, 0x74, 0x61, 0x6C,
+                               0x65, 0x64, 0x61, 0x72, 0x67,
+                               0x73, 0x81, 0x01};
+    const rpc_function_entry_t stale = {"stale", invalidating_calls, RPC_ARGS(CBOR_TYPE_UNSIGNED_INTEGER), false, true,
+                                        NULL};
+    static rpc_registry_slot_t slots[1];
+    uint8_t response[32];
+    rpc_client_response_t decoded;
+    uint64_t result;
+
+    // a result computed while the cache was invalidated is not stored, it may be stale already
+    assert_int_equal(rpc_registry_init(&rpc_dispatcher, slots, 1), RPC_REGISTRY_OK);
+    assert_int_equal(rpc_register_function(&rpc_dispatcher, &stale), RPC_REGISTRY_OK);
+    for (uint64_t i = 1; i <= 2; i++) {
+        size_t response_size = sizeof(response);
+        assert_int_equal(execute_rpc_call(&rpc_dispatcher, stale_request, sizeof(stale_request), response,
+                                          &response_size, &calls), RPC_OK);
+        assert_int_equal(rpc_client_decode_response(&decoded, response, response_size), RPC_OK);
+        assert_int_equal(cbor_value_get_uint64(&decoded.result, &result), CborNoError);
+        assert_int_equal(result, 5 + i);
+    }
+    assert_int_equal(rpc_unregister_function(&rpc_dispatcher, "stale"), RPC_REGISTRY_OK);
+}
+
+static rpc_error_t registered_call(const uint8_t *request, size_t request_size, size_t *calls, uint64_t *result) {
+    uint8_t response[64];
+    size_t response_size = sizeof(response);
+    rpc_client_response_t decoded;
+
+    rpc_error_t err = execute_rpc_call(&alt_dispatcher, request, request_size, response, &response_size, calls);
+
+    assert_int_equal(rpc_client_decode_response(&decoded, response, response_size), RPC_OK);
+    assert_int_equal(decoded.error, err);
+    if (err == RPC_OK) assert_int_equal(cbor_value_get_uint64(&decoded.result, result), CborNoError);
+    return err;
+}
+
+static void registry_test(void **state) {
+    // request: {"id": 1, "func": "counted", "args": [7]}
+    uint8_t counted_request[] = {0xA3, 0x62, 0x69, 0x64, 0x01,
+                                 0x64, 0x66, 0x75, 0x6E, 0x63,
+                                 0x67, 0x63, 0x6F, 0x75, 0x6E,
+                                 0x74, 0x65, 0x64, 0x64, 0x61,
+                                 0x72, 0x67, 0x73, 0x81, 0x07};
+
+    // request: {"id": 2, "func": "counted", "args": ["x"]}
+    uint8_t wrong_args_request[] = {0xA3, 0x62, 0x69, 0x64, 0x02,
+                                    0x64, 0x66, 0x75, 0x6E, 0x63,
+                                    0x67, 0x63, 0x6F, 0x75, 0x6E,
+                                    0x74, 0x65, 0x64, 0x64, 0x61,
+                                    0x72, 0x67, 0x73, 0x81, 0x61,
+                                    0x78};
+
+    const rpc_function_entry_t counted = {"counted", rpc__cached_calls, RPC_ARGS(CBOR_TYPE_UNSIGNED_INTEGER), false,
+                                          false, NULL};
+    const rpc_function_entry_t add = {"add", rpc___ping, RPC_NO_ARGS, false, false, NULL};
+    const rpc_function_entry_t others[] = {{"first", rpc___ping, RPC_NO_ARGS, false, false, NULL},
+                                           {"second", rpc___ping, RPC_NO_ARGS, false, false, NULL},
+                                           {"third", rpc___ping, RPC_NO_ARGS, false, false, NULL}};
+    static rpc_registry_slot_t slots[4];
+    size_t calls = 0;
+    uint64_t result;
+
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &counted), RPC_REGISTRY_INVALID);
+    assert_int_equal(rpc_registry_init(&alt_dispatcher, slots, 3), RPC_REGISTRY_INVALID);
+    assert_int_equal(rpc_registry_init(&alt_dispatcher, slots, 4), RPC_REGISTRY_OK);
+
+    // names are unique across the table and the registry
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &add), RPC_REGISTRY_NAME_TAKEN);
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &counted), RPC_REGISTRY_OK);
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &counted), RPC_REGISTRY_NAME_TAKEN);
+
+    const size_t index = rpc_lookup_index_by_key(&alt_dispatcher, "counted");
+    assert_true(index >= rpc_get_key_count(&alt_dispatcher));
+    assert_string_equal(rpc_lookup_key_by_index(&alt_dispatcher, index), "counted");
+    assert_int_equal(rpc_lookup_index_by_name(&alt_dispatcher, "counted_and_more", 7), index);
+    assert_int_equal(rpc_lookup_index_by_key(&alt_dispatcher, "count"), -1);
+
+    // called by name and by index, with the argument types checked like for the table
+    assert_int_equal(registered_call(counted_request, sizeof(counted_request), &calls, &result), RPC_OK);
+    assert_int_equal(result, 1);
+    assert_int_equal(registered_call(wrong_args_request, sizeof(wrong_args_request), &calls, &result),
+                     RPC_ERROR_INVALID_ARGS);
+
+    uint8_t request[32];
+    rpc_client_request_t encoder;
+    rpc_client_request_init(&encoder, request, sizeof(request), 3, index, 1);
+    cbor_encode_uint(&encoder.args, 7);
+    size_t request_size = rpc_client_request_finish(&encoder);
+
+    assert_int_equal(registered_call(request, request_size, &calls, &result), RPC_OK);
+    assert_int_equal(result, 2);
+
+    // fills the other three slots
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &others[0]), RPC_REGISTRY_OK);
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &others[1]), RPC_REGISTRY_OK);
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &others[2]), RPC_REGISTRY_OK);
+
+    const rpc_function_entry_t fifth = {"fifth", rpc___ping, RPC_NO_ARGS, false, false, NULL};
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &fifth), RPC_REGISTRY_FULL);
+
+    // the others are still found past the removed slot
+    assert_int_equal(rpc_unregister_function(&alt_dispatcher, "counted"), RPC_REGISTRY_OK);
+    assert_int_equal(rpc_unregister_function(&alt_dispatcher, "counted"), RPC_REGISTRY_NOT_FOUND);
+    assert_int_equal(rpc_lookup_index_by_key(&alt_dispatcher, "counted"), -1);
+    assert_null(rpc_lookup_key_by_index(&alt_dispatcher, index));
+    assert_int_equal(registered_call(counted_request, sizeof(counted_request), &calls, &result),
+                     RPC_ERROR_METHOD_NOT_FOUND);
+    assert_int_equal(registered_call(request, request_size, &calls, &result), RPC_ERROR_METHOD_NOT_FOUND);
+
+    for (size_t i = 0; i < 3; i++) {
+        assert_int_not_equal(rpc_lookup_index_by_key(&alt_dispatcher, others[i].name), -1);
+    }
+
+    // the freed slot is taken again
+    assert_int_equal(rpc_register_function(&alt_dispatcher, &fifth), RPC_REGISTRY_OK);
+    assert_string_equal(rpc_lookup_key_by_index(&alt_dispatcher, index), "fifth");
+    assert_int_equal(calls, 2);
+
+    // leave the registry empty for the other tests
+    assert_int_equal(rpc_unregister_function(&alt_dispatcher, "fifth"), RPC_REGISTRY_OK);
+    for (size_t i = 0; i < 3; i++) {
+        assert_int_equal(rpc_unregister_function(&alt_dispatcher, others[i].name), RPC_REGISTRY_OK);
+    }
+
+    // no function is left to probe past the removed slots, so they are all free again
+    for (size_t i = 0; i < 4; i++) assert_null(slots[i].function);
+}
+
+// the error code of the response, with the result stored at *result if there is one
+static rpc_error_t limited_call(const rpc_dispatcher_t *dispatcher, const uint8_t *request, size_t request_size,
+                                uint64_t *result) {
+    uint8_t response[64];
+    size_t response_size = sizeof(response);
+    rpc_client_response_t decoded;
+
+    rpc_error_t err = execute_rpc_call(dispatcher, request, request_size, response, &response_size, NULL);
+
+    assert_int_equal(rpc_client_decode_response(&decoded, response, response_size), RPC_OK);
+    assert_int_equal(decoded.error, err);
+    if (err == RPC_OK) assert_int_equal(cbor_value_get_uint64(&decoded.result, result), CborNoError);
+    return err;
+}
+
+// {"id": 9, "func": func, "args": [[[...[1]...]]]} with the argument nested depth arrays deep, args first if asked
+static size_t encode_nested_request(uint8_t *buffer, size_t size, const char *func, bool args_first, size_t depth) {
+    const uint8_t header[] = {0xA3, 0x62, 0x69, 0x64, 0x09};
+    const uint8_t func_key[] = {0x64, 0x66, 0x75, 0x6E, 0x63};
+    const uint8_t args_key[] = {0x64, 0x61, 0x72, 0x67, 0x73, 0x81};
+    const size_t func_length = strlen(func);
+    const size_t func_size = sizeof(func_key) + 1 + func_length;
+    const size_t args_size = sizeof(args_key) + depth + 1;
+
+    assert_true(func_length < 24 && sizeof(header) + func_size + args_size <= size);
+
+    uint8_t *func_part = buffer + sizeof(header) + (args_first ? args_size : 0);
+    uint8_t *args_part = buffer + sizeof(header) + (args_first ? 0 : func_size);
+
+    memcpy(buffer, header, sizeof(header));
+    memcpy(func_part, func_key, sizeof(func_key));
+    func_part[sizeof(func_key)] = (uint8_t) (0x60 | func_length);
+    memcpy(func_part + sizeof(func_key) + 1, func, func_length);
+
+    memcpy(args_part, args_key, sizeof(args_key));
+    memset(args_part + sizeof(args_key), 0x81, depth);
+    args_part[sizeof(args_key) + depth] = 0x01;
+
+    return sizeof(header) + func_size + args_size;
+}
+
+static void limits_test(void **state) {
+    // _limited takes up to depth 2, 8 items and 16 string bytes
+
+    // request: {"id": 1, "func": "_limited", "args": [[1, [2, 3], "abcd"]]}
+    uint8_t within_request[] = {0xA3, 0x62, 0x69, 0x64, 0x01,
+                                0x64, 0x66, 0x75, 0x6E, 0x63,
+                                0x68, 0x5F, 0x6C, 0x69, 0x6D,
+                                0x69, 0x74, 0x65, 0x64, 0x64,
+                                0x61, 0x72, 0x67, 0x73, 0x81,
+                                0x83, 0x01, 0x82, 0x02, 0x03,
+                                0x64, 0x61, 0x62, 0x63, 0x64};
+
+    // request: {"id": 2, "func": "_limited", "args": [[[[1]]]]}
+    uint8_t deep_request[] = {0xA3, 0x62, 0x69, 0x64, 0x02,
+                              0x64, 0x66, 0x75, 0x6E, 0x63,
+                              0x68, 0x5F, 0x6C, 0x69, 0x6D,
+                              0x69, 0x74, 0x65, 0x64, 0x64,
+                              0x61, 0x72, 0x67, 0x73, 0x81,
+                              0x81, 0x81, 0x81, 0x01};
+
+    // response: {"id": 2, "err": {"c": -32003, "msg": "Request exceeds limits"}}
+    uint8_t expected_deep_response[] = {0xA2, 0x62, 0x69, 0x64, 0x02,
+                                        0x63, 0x65, 0x72, 0x72, 0xA2,
+                                        0x61, 0x63, 0x39, 0x7D, 0x02,
+                                        0x63, 0x6D, 0x73, 0x67, 0x76,
+                                        0x52, 0x65, 0x71, 0x75, 0x65,
+                                        0x73, 0x74, 0x20, 0x65, 0x78,
+                                        0x63, 0x65, 0x65, 0x64, 0x73,
+                                        0x20, 0x6C, 0x69, 0x6D, 0x69,
+                                        0x74, 0x73};
+
+    // request: {"id": 3, "func": "_limited", "args": [[1, 2, 3, 4, 5, 6, 7, 8]]}
+    uint8_t many_items_request[] = {0xA3, 0x62, 0x69, 0x64, 0x03,
+                                    0x64, 0x66, 0x75, 0x6E, 0x63,
+                                    0x68, 0x5F, 0x6C, 0x69, 0x6D,
+                                    0x69, 0x74, 0x65, 0x64, 0x64,
+                                    0x61, 0x72, 0x67, 0x73, 0x81,
+                                    0x88, 0x01, 0x02, 0x03, 0x04,
+                                    0x05, 0x06, 0x07, 0x08};
+
+    // request: {"id": 4, "func": "_limited", "args": [["0123456789", "0123456789"]]}
+    uint8_t long_strings_request[] = {0xA3, 0x62, 0x69, 0x64, 0x04,
+                                      0x64, 0x66, 0x75, 0x6E, 0x63,
+                                      0x68, 0x5F, 0x6C, 0x69, 0x6D,
+                                      0x69, 0x74, 0x65, 0x64, 0x64,
+                                      0x61, 0x72, 0x67, 0x73, 0x81,
+                                      0x82, 0x6A, 0x30, 0x31, 0x32,
+                                      0x33, 0x34, 0x35, 0x36, 0x37,
+                                      0x38, 0x39, 0x6A, 0x30, 0x31,
+                                      0x32, 0x33, 0x34, 0x35, 0x36,
+                                      0x37, 0x38, 0x39};
+
+    // request: {"id": 5, "args": [[1, [2, 3], "abcd"]], "func": "_limited"}
+    uint8_t args_first_request[] = {0xA3, 0x62, 0x69, 0x64, 0x05,
+                                    0x64, 0x61, 0x72, 0x67, 0x73,
+                                    0x81, 0x83, 0x01, 0x82, 0x02,
+                                    0x03, 0x64, 0x61, 0x62, 0x63,
+                                    0x64, 0x64, 0x66, 0x75, 0x6E,
+                                    0x63, 0x68, 0x5F, 0x6C, 0x69,
+                                    0x6D, 0x69, 0x74, 0x65, 0x64};
+
+    // request: {"id": 6, "args": [[[[1]]]], "func": "_limited"}
+    uint8_t args_first_deep_request[] = {0xA3, 0x62, 0x69, 0x64, 0x06,
+                                         0x64, 0x61, 0x72, 0x67, 0x73,
+                                         0x81, 0x81, 0x81, 0x81, 0x01,
+                                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                                         0x68, 0x5F, 0x6C, 0x69, 0x6D,
+                                         0x69, 0x74, 0x65, 0x64};
+
+    // request: {"id": 7, "func": "add", "args": [[1], 2]}
+    uint8_t add_request[] = {0xA3, 0x62, 0x69, 0x64, 0x07,
+                             0x64, 0x66, 0x75, 0x6E, 0x63,
+                             0x63, 0x61, 0x64, 0x64, 0x64,
+                             0x61, 0x72, 0x67, 0x73, 0x82,
+                             0x81, 0x01, 0x02};
+
+    // request: {"id": 8, "func": "add", "args": [[[1]], 2]}
+    uint8_t add_deep_request[] = {0xA3, 0x62, 0x69, 0x64, 0x08,
+                                  0x64, 0x66, 0x75, 0x6E, 0x63,
+                                  0x63, 0x61, 0x64, 0x64, 0x64,
+                                  0x61, 0x72, 0x67, 0x73, 0x82,
+                                  0x81, 0x81, 0x01, 0x02};
+
+    uint64_t result;
+    assert_int_equal(limited_call(&rpc_dispatcher, within_request, sizeof(within_request), &result), RPC_OK);
+    assert_int_equal(result, 3);
+
+    uint8_t response_buffer[64];
+    size_t response_size = sizeof(response_buffer);
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, deep_request, sizeof(deep_request), response_buffer,
+                                       &response_size, NULL);
+    assert_int_equal(err, RPC_ERROR_LIMIT_EXCEEDED);
+    assert_int_equal(response_size, sizeof(expected_deep_response));
+    assert_memory_equal(expected_deep_response, response_buffer, response_size);
+
+    assert_int_equal(limited_call(&rpc_dispatcher, many_items_request, sizeof(many_items_request), &result),
+                     RPC_ERROR_LIMIT_EXCEEDED);
+    assert_int_equal(limited_call(&rpc_dispatcher, long_strings_request, sizeof(long_strings_request), &result),
+                     RPC_ERROR_LIMIT_EXCEEDED);
+
+    // args in front of func are measured and checked once the function is known
+    assert_int_equal(limited_call(&rpc_dispatcher, args_first_request, sizeof(args_first_request), &result), RPC_OK);
+    assert_int_equal(result, 3);
+    assert_int_equal(limited_call(&rpc_dispatcher, args_first_deep_request, sizeof(args_first_deep_request),
+                                  &result), RPC_ERROR_LIMIT_EXCEEDED);
+
+    // limits given to generate_api apply to the whole table, before the argument types are checked
+    assert_int_equal(limited_call(&alt_dispatcher, add_request, sizeof(add_request), &result),
+                     RPC_ERROR_INVALID_ARGS);
+    assert_int_equal(limited_call(&alt_dispatcher, add_deep_request, sizeof(add_deep_request), &result),
+                     RPC_ERROR_LIMIT_EXCEEDED);
+
+    // nested far deeper than any limit, given up on at the depth bound instead of being walked to the bottom
+    static uint8_t nested_request[4096];
+    size_t request_size = encode_nested_request(nested_request, sizeof(nested_request), "_limited", false, 4000);
+    assert_int_equal(limited_call(&rpc_dispatcher, nested_request, request_size, &result), RPC_ERROR_LIMIT_EXCEEDED);
+
+    // functions without limits are not bounded by those of others, whatever the key order
+    request_size = encode_nested_request(nested_request, sizeof(nested_request), "sum_array", false, 40);
+    rpc_error_t func_first = limited_call(&rpc_dispatcher, nested_request, request_size, &result);
+    request_size = encode_nested_request(nested_request, sizeof(nested_request), "sum_array", true, 40);
+    rpc_error_t args_first = limited_call(&rpc_dispatcher, nested_request, request_size, &result);
+
+    assert_int_equal(func_first, RPC_ERROR_INVALID_ARGS);
+    assert_int_equal(args_first, func_first);
+}
+
+static void incremental_parser_byte_by_byte_test(void **state) {
+    // request: {"id": 13, "func": "sum_array", "args":[[1,2,3,4,5]]}
+    uint8_t request[] = {0xA3, 0x62, 0x69, 0x64, 0x0D,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x69, 0x73, 0x75, 0x6D, 0x5F,
+                         0x61, 0x72, 0x72, 0x61, 0x79,
+                         0x64, 0x61, 0x72, 0x67, 0x73,
+                         0x81, 0x85, 0x01, 0x02, 0x03,
+                         0x04, 0x05};
+
+    // response: {"id": 13, "res": 15}
+    uint8_t expected_response[] = {0xA2, 0x62, 0x69, 0x64, 0x0D,
+                                   0x63, 0x72, 0x65, 0x73, 0x0F};
+
+    uint8_t parser_buffer[64];
+    rpc_incremental_parser_t parser;
+    rpc_incremental_parser_init(&parser, parser_buffer, sizeof(parser_buffer));
+
+    for (size_t i = 0; i < sizeof(request); i++) {
+        size_t consumed = 0;
+        rpc_parser_status_t status = rpc_incremental_parser_feed(&parser, &request[i], 1, &consumed);
+        assert_int_equal(consumed, 1);
+        assert_int_equal(status, i == sizeof(request) - 1 ? RPC_PARSER_COMPLETE : RPC_PARSER_NEED_MORE);
+    }
+
+    const uint8_t *complete_request;
+    size_t complete_request_size;
+    assert_true(rpc_incremental_parser_get_request(&parser, &complete_request, &complete_request_size));
+    assert_int_equal(complete_request_size, sizeof(request));
+
+    uint8_t response_buffer[512];
+    memset(response_buffer, 0, sizeof(response_buffer));
+    size_t response_size = sizeof(response_buffer);
+
+    rpc_error_t err = execute_rpc_call(&rpc_dispatcher, complete_request,
+                                       complete_request_size, response_buffer, &response_size, NULL);
+    assert_true(err == RPC_OK);
+    assert_int_equal(response_size, sizeof(expected_response));
+
+    assert_memory_equal(expected_response, response_buffer, sizeof(expected_response));
+}
+
+static void incremental_parser_back_to_back_test(void **state) {
+    // request: {"id": 12, "func": "__ping"} {"id": 12, "func": 1}
+    uint8_t requests[] = {0xA2, 0x62, 0x69, 0x64, 0x0C,
+                          0x64, 0x66, 0x75, 0x6E, 0x63,
+                          0x66, 0x5F, 0x5F, 0x70, 0x69,
+                          0x6E, 0x67, 0xA2, 0x62, 0x69,
+                          0x64, 0x0C, 0x64, 0x66, 0x75,
+                          0x6E, 0x63, 0x01};
+
+    uint8_t parser_buffer[64];
+    rpc_incremental_parser_t parser;
+    rpc_incremental_parser_init(&parser, parser_buffer, sizeof(parser_buffer));
+
+    size_t consumed = 0;
+    assert_int_equal(rpc_incremental_parser_feed(&parser, requests, sizeof(requests), &consumed), RPC_PARSER_COMPLETE);
+    assert_int_equal(consumed, sizeof(requests));
+
+    const uint8_t *complete_request;
+    size_t complete_request_size;
+    assert_true(rpc_incremental_parser_get_request(&parser, &complete_request, &complete_request_size));
+    assert_int_equal(complete_request_size, 17);
+
+    // the second request was already received with the first one
+    assert_int_equal(rpc_incremental_parser_reset(&parser), RPC_PARSER_COMPLETE);
+    assert_true(rpc_incremental_parser_get_request(&parser, &complete_request, &complete_request_size));
+    assert_int_equal(complete_request_size, 11);
+    assert_memory_equal(complete_request, &requests[17], 11);
+
+    assert_int_equal(rpc_incremental_parser_reset(&parser), RPC_PARSER_NEED_MORE);
+}
+
+static void incremental_parser_too_large_test(void **state) {
+    // request: {"id": 12, "func": "always_error", "args":[]}
+    uint8_t request[] = {0xA3, 0x62, 0x69, 0x64, 0x0C,
+                         0x64, 0x66, 0x75, 0x6E, 0x63,
+                         0x6C, 0x61, 0x6C, 0x77, 0x61,
+                         0x79, 0x73, 0x5F, 0x65, 0x72,
+                         0x72, 0x6F, 0x72, 0x64, 0x61,
+                         0x72, 0x67, 0x73, 0x80};
+
+    uint8_t parser_buffer[16];
+    rpc_incremental_parser_t parser;
+    rpc_incremental_parser_init(&parser, parser_buffer, sizeof(parser_buffer));
+
+    size_t consumed = 0;
+    assert_int_equal(rpc_incremental_parser_feed(&parser, request, sizeof(request), &consumed), RPC_PARSER_ERROR);
+}
+
+static void framing_length_prefix_test(void **state) {
+    // two frames with the request: {"id": 12, "func": "__ping"}
+    uint8_t frames[] = {0x00, 0x11, 0xA2, 0x62, 0x69,
+                        0x64, 0x0C, 0x64, 0x66, 0x75,
+                        0x6E, 0x63, 0x66, 0x5F, 0x5F,
+                        0x70, 0x69, 0x6E, 0x67, 0x00,
+                        0x11, 0xA2, 0x62, 0x69, 0x64,
+                        0x0C, 0x64, 0x66, 0x75, 0x6E,
+                        0x63, 0x66, 0x5F, 0x5F, 0x70,
+                        0x69, 0x6E, 0x67};
+
+    // two frames with the response: {"id": 12, "res": "pong"}
+    uint8_t expected_frames[] = {0x00, 0x0E, 0xA2, 0x62, 0x69,
+                                 0x64, 0x0C, 0x63, 0x72, 0x65,
+                                 0x73, 0x64, 0x70, 0x6F, 0x6E,
+                                 0x67, 0x00, 0x0E, 0xA2, 0x62,
+                                 0x69, 0x64, 0x0C, 0x63, 0x72,
+                                 0x65, 0x73, 0x64, 0x70, 0x6F,
+                                 0x6E, 0x67};
+
+    uint8_t rx_buffer[64];
+    uint8_t tx_buffer[256];
+    rpc_frame_reader_t reader;
+    rpc_frame_writer_t writer;
+    rpc_frame_reader_init(&reader, RPC_FRAMING_LENGTH_PREFIX, rx_buffer, sizeof(rx_buffer));
+    rpc_frame_writer_init(&writer, RPC_FRAMING_LENGTH_PREFIX, tx_buffer, sizeof(tx_buffer));
+
+    // the first frame arrives in two parts
+    size_t available;
+    uint8_t *write_buffer = rpc_frame_reader_get_write_buffer(&reader, &available);
+    memcpy(write_buffer, frames, 10);
+    rpc_frame_reader_commit(&reader, 10);
+
+    const uint8_t *frame;
+    size_t frame_size;
+    assert_int_equal(rpc_frame_reader_next(&reader, &frame, &frame_size), RPC_FRAME_NEED_MORE);
+
+    write_buffer = rpc_frame_reader_get_write_buffer(&reader, &available);
+    memcpy(write_buffer, frames + 10, sizeof(frames) - 10);
+    rpc_frame_reader_commit(&reader, sizeof(frames) - 10);
+
+    // the request is passed on right where it was received
+    assert_int_equal(rpc_frame_reader_next(&reader, &frame, &frame_size), RPC_FRAME_COMPLETE);
+    assert_ptr_equal(frame, rx_buffer + 2);
+    assert_int_equal(frame_size, 17);
+
+    rpc_framing_process(&reader, &writer, &rpc_dispatcher, 128, NULL);
+    assert_int_equal(rpc_frame_reader_next(&reader, &frame, &frame_size), RPC_FRAME_NEED_MORE);
+
+    size_t tx_size;
+    const uint8_t *tx = rpc_frame_writer_peek(&writer, &tx_size);
+    assert_int_equal(tx_size, sizeof(expected_frames));
+    assert_memory_equal(tx, expected_frames, sizeof(expected_frames));
+}
+
+static void framing_cobs_test(void **state) {
+    // an empty frame, then the request: {"id": 256, "func": "__ping"}
+    uint8_t frames[] = {0x00, 0x07, 0xA2, 0x62, 0x69,
+                        0x64, 0x19, 0x01, 0x0D, 0x64,
+                        0x66, 0x75, 0x6E, 0x63, 0x66,
+                        0x5F, 0x5F, 0x70, 0x69, 0x6E,
+                        0x67, 0x00};
+
+    // response: {"id": 256, "res": "pong"}
+    uint8_t expected_frame[] = {0x07, 0xA2, 0x62, 0x69, 0x64,
+                                0x19, 0x01, 0x0A, 0x63, 0x72,
+                                0x65, 0x73, 0x64, 0x70, 0x6F,
+                                0x6E, 0x67, 0x00};
+
+    uint8_t rx_buffer[64];
+    uint8_t tx_buffer[256];
+    rpc_frame_reader_t reader;
+    rpc_frame_writer_t writer;
+    rpc_frame_reader_init(&reader, RPC_FRAMING_COBS, rx_buffer, sizeof(rx_buffer));
+    rpc_frame_writer_init(&writer, RPC_FRAMING_COBS, tx_buffer, sizeof(tx_buffer));
+
+    for (size_t i = 0; i < sizeof(frames); i++) {
+        size_t available;
+        uint8_t *write_buffer = rpc_frame_reader_get_write_buffer(&reader, &available);
+        assert_true(available > 0);
+
+        *write_buffer = frames[i];
+        rpc_frame_reader_commit(&reader, 1);
+        rpc_framing_process(&reader, &writer, &rpc_dispatcher, 128, NULL);
+    }
+
+    size_t tx_size;
+    const uint8_t *tx = rpc_frame_writer_peek(&writer, &tx_size);
+    assert_int_equal(tx_size, sizeof(expected_frame));
+    assert_memory_equal(tx, expected_frame, sizeof(expected_frame));
+
+    rpc_frame_writer_consume(&writer, tx_size);
+    rpc_frame_writer_peek(&writer, &tx_size);
+    assert_int_equal(tx_size, 0);
+}
+
+static void framing_cobs_too_large_test(void **state) {
+    // request: {"id": 256, "func": "__ping"}
+    uint8_t request_frame[] = {0x07, 0xA2, 0x62, 0x69, 0x64,
+                               0x19, 0x01, 0x0D, 0x64, 0x66,
+                               0x75, 0x6E, 0x63, 0x66, 0x5F,
+                               0x5F, 0x70, 0x69, 0x6E, 0x67,
+                               0x00};
+
+    // a 40 byte frame that does not fit, followed by the request
+    uint8_t frames[40 + sizeof(request_frame)];
+    memset(frames, 0x01, 40);
+    frames[39] = 0x00;
+    memcpy(frames + 40, request_frame, sizeof(request_frame));
+
+    uint8_t rx_buffer[24];
+    rpc_frame_reader_t reader;
+    rpc_frame_reader_init(&reader, RPC_FRAMING_COBS, rx_buffer, sizeof(rx_buffer));
+
+    size_t received = 0;
+    size_t dropped = 0;
+    const uint8_t *frame;
+    size_t frame_size;
+    rpc_frame_status_t status = RPC_FRAME_NEED_MORE;
+
+    while (status != RPC_FRAME_COMPLETE && received < sizeof(frames)) {
+        size_t available;
+        uint8_t *write_buffer = rpc_frame_reader_get_write_buffer(&reader, &available);
+        if (available > sizeof(frames) - received) available = sizeof(frames) - received;
+
+        memcpy(write_buffer, frames + received, available);
+        rpc_frame_reader_commit(&reader, available);
+        received += available;
+
+        while ((status = rpc_frame_reader_next(&reader, &frame, &frame_size)) == RPC_FRAME_DROPPED) dropped++;
+    }
+
+    // the request after the dropped frame is found again
+    assert_int_equal(dropped, 1);
+    assert_int_equal(status, RPC_FRAME_COMPLETE);
+    assert_int_equal(frame_size, 19);
+    assert_memory_equal(frame, request_frame + 1, 6);
+}
+
+static void framing_writer_wrap_test(void **state) {
+    // three frames with the request: {"id": 12, "func": "__ping"}
+    uint8_t frame[] = {0x00, 0x11, 0xA2, 0x62, 0x69,
+                       0x64, 0x0C, 0x64, 0x66, 0x75,
+                       0x6E, 0x63, 0x66, 0x5F, 0x5F,
+                       0x70, 0x69, 0x6E, 0x67};
+
+    uint8_t rx_buffer[64];
+    rpc_frame_reader_t reader;
+    rpc_frame_reader_init(&reader, RPC_FRAMING_LENGTH_PREFIX, rx_buffer, sizeof(rx_buffer));
+
+    for (size_t i = 0; i < 3; i++) {
+        size_t available;
+        uint8_t *write_buffer = rpc_frame_reader_get_write_buffer(&reader, &available);
+        memcpy(write_buffer, frame, sizeof(frame));
+        rpc_frame_reader_commit(&reader, sizeof(frame));
+    }
+
+    // room for two 16 byte response frames at the end of the buffer
+    uint8_t tx_buffer[40];
+    rpc_frame_writer_t writer;
+    rpc_frame_writer_init(&writer, RPC_FRAMING_LENGTH_PREFIX, tx_buffer, sizeof(tx_buffer));
+
+    // a response bound larger than the whole buffer could never be written, nothing is read
+    assert_int_equal(rpc_framing_process(&reader, &writer, &rpc_dispatcher, 39, NULL), RPC_ERROR_INVALID_ARGS);
+    assert_int_equal(rpc_framing_process(&reader, &writer, &rpc_dispatcher, 14, NULL), RPC_OK);
+
+    size_t tx_size;
+    const uint8_t *tx = rpc_frame_writer_peek(&writer, &tx_size);
+    assert_ptr_equal(tx, tx_buffer);
+    assert_int_equal(tx_size, 32);
+
+    // the third request waits until the first response was sent, then its response goes to the start
+    const uint8_t *request;
+    size_t request_size;
+    assert_int_equal(rpc_frame_reader_next(&reader, &request, &request_size), RPC_FRAME_COMPLETE);
+
+    rpc_frame_writer_consume(&writer, 16);
+    assert_int_equal(rpc_framing_process(&reader, &writer, &rpc_dispatcher, 14, NULL), RPC_OK);
+    assert_int_equal(rpc_frame_reader_next(&reader, &request, &request_size), RPC_FRAME_NEED_MORE);
+
+    tx = rpc_frame_writer_peek(&writer, &tx_size);
+    assert_ptr_equal(tx, tx_buffer + 16);
+    assert_int_equal(tx_size, 16);
+    rpc_frame_writer_consume(&writer, tx_size);
+
+    tx = rpc_frame_writer_peek(&writer, &tx_size);
+    assert_ptr_equal(tx, tx_buffer);
+    assert_int_equal(tx_size, 16);
+    assert_memory_equal(tx, tx_buffer + 16, 16);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(version_test),
             cmocka_unit_test(ping_test),
+            cmocka_unit_test(ping_id_encoding_test),
             cmocka_unit_test(func_list_test),
+            cmocka_unit_test(schema_test),
 
             cmocka_unit_test(lookup_test),
 
@@ -454,13 +2214,57 @@ int main(void) {
             cmocka_unit_test(hidden_ping_test_by_index),
             cmocka_unit_test(invalid_index_test),
             cmocka_unit_test(echo_test),
+            cmocka_unit_test(echo_args_first_test),
+            cmocka_unit_test(string_view_test),
 
             cmocka_unit_test(error_test),
             cmocka_unit_test(method_not_found_test),
+            cmocka_unit_test(missing_func_test),
             cmocka_unit_test(sum_array_bad_types_test),
+            cmocka_unit_test(lazy_args_test),
 
             cmocka_unit_test(error_buffer_too_small_test),
             cmocka_unit_test(ping_response_buffer_too_small_test),
+
+            cmocka_unit_test(compact_echo_test),
+            cmocka_unit_test(compact_error_test),
+            cmocka_unit_test(compact_mixed_keys_test),
+            cmocka_unit_test(compact_key_map_test),
+
+            cmocka_unit_test(multiple_dispatchers_test),
+
+            cmocka_unit_test(server_stress_test),
+            cmocka_unit_test(server_create_overflow_test),
+
+            cmocka_unit_test(max_response_size_test),
+            cmocka_unit_test(max_error_response_size_test),
+
+            cmocka_unit_test(batch_array_test),
+            cmocka_unit_test(batch_sequence_test),
+
+            cmocka_unit_test(streaming_func_list_test),
+            cmocka_unit_test(streaming_error_test),
+            cmocka_unit_test(byte_string_reference_test),
+
+            cmocka_unit_test(deferred_call_test),
+            cmocka_unit_test(deferred_batch_test),
+            cmocka_unit_test(session_window_test),
+
+            cmocka_unit_test(stats_test),
+
+            cmocka_unit_test(client_request_test),
+            cmocka_unit_test(response_cache_test),
+            cmocka_unit_test(registry_test),
+            cmocka_unit_test(limits_test),
+
+            cmocka_unit_test(incremental_parser_byte_by_byte_test),
+            cmocka_unit_test(incremental_parser_back_to_back_test),
+            cmocka_unit_test(incremental_parser_too_large_test),
+
+            cmocka_unit_test(framing_length_prefix_test),
+            cmocka_unit_test(framing_cobs_test),
+            cmocka_unit_test(framing_cobs_too_large_test),
+            cmocka_unit_test(framing_writer_wrap_test),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -4,8 +4,21 @@ from api_gen import generate_api, CborTypes
 current_path = os.path.dirname(os.path.realpath(__file__))
 
 generate_api(current_path, {
-    "echo": [CborTypes.CBOR_TYPE_TEXT_STRING],
+    "echo": {"args": [("text", CborTypes.CBOR_TYPE_TEXT_STRING)], "typed": True,
+             "result": (CborTypes.CBOR_TYPE_TEXT_STRING, 64)},
     "always_error": [],
-    "sum_array": [CborTypes.CBOR_TYPE_ARRAY],
-    "_hidden_ping": []
-})
\ No newline at end of file
+    "sum_array": {"args": [("values", CborTypes.CBOR_TYPE_ARRAY)], "typed": True,
+                  "result": CborTypes.CBOR_TYPE_SIGNED_INTEGER, "lazy": True},
+    "_hidden_ping": [],
+    "_deferred_ping": [],
+    "_session_ping": [],
+    "_read_blob": [],
+    "_cached_calls": {"args": [CborTypes.CBOR_TYPE_UNSIGNED_INTEGER], "cacheable": True},
+    "_limited": {"args": [CborTypes.CBOR_TYPE_ARRAY], "limits": {"depth": 2, "items": 8, "string_bytes": 16}}
+})
+
+# a second, independent table linked into the same test binary
+generate_api(current_path, {
+    "add": {"args": [("a", CborTypes.CBOR_TYPE_SIGNED_INTEGER), ("b", CborTypes.CBOR_TYPE_SIGNED_INTEGER)],
+            "typed": True, "result": CborTypes.CBOR_TYPE_SIGNED_INTEGER}
+}, prefix="alt", limits={"depth": 1, "items": 4})
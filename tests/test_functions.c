@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "simplecborrpc.h"
+#include "rpc_session.h"
+#include "rpc_api.h"
+#include "alt_api.h"
+
+rpc_error_t
+rpc__hidden_ping(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    cbor_encode_text_stringz(result, "pong");
+
+    return RPC_OK;
+}
+
+rpc_error_t
+rpc__deferred_ping(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    // the test answers the call itself, through the token stored at user_ptr
+    return rpc_defer(result, (rpc_deferred_t *) user_ptr);
+}
+
+rpc_error_t
+rpc__session_ping(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    rpc_session_handle_t handle;
+    return rpc_session_defer((rpc_session_t *) user_ptr, result, &handle);
+}
+
+rpc_error_t
+rpc__read_blob(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    // the test passes the memory to return at user_ptr
+    const rpc_iovec_t *blob = (const rpc_iovec_t *) user_ptr;
+    if (rpc_encode_byte_string_reference(result, blob->data, blob->size) != CborNoError) return RPC_ERROR_ENCODE_ERROR;
+
+    return RPC_OK;
+}
+
+rpc_error_t
+rpc__cached_calls(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    // answers with the number of times it ran, counted at user_ptr
+    size_t *calls = (size_t *) user_ptr;
+    (*calls)++;
+
+    if (cbor_encode_uint(result, *calls) != CborNoError) return RPC_ERROR_ENCODE_ERROR;
+
+    return RPC_OK;
+}
+
+rpc_error_t
+rpc__limited(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    // only runs for arguments within the limits, answers with the length of the array
+    size_t length;
+    if (cbor_value_get_array_length(args_iterator, &length) != CborNoError) return RPC_ERROR_INVALID_ARGS;
+
+    if (cbor_encode_uint(result, length) != CborNoError) return RPC_ERROR_ENCODE_ERROR;
+
+    return RPC_OK;
+}
+
+rpc_error_t
+rpc_echo_typed(const rpc_echo_args_t *args, rpc_echo_result_t *result, const char **error_msg, void *user_ptr) {
+    if (args->text_length > 64) {
+        *error_msg = "String too long";
+        return RPC_ERROR_INVALID_ARGS;
+    }
+
+    // the result points into the request, it is encoded before the input buffer goes away
+    result->value = args->text;
+    result->value_length = args->text_length;
+
+    return RPC_OK;
+}
+
+rpc_error_t
+rpc_always_error(const CborValue *args_iterator, CborEncoder *result, const char **error_msg, void *user_ptr) {
+    *error_msg = "this is a test error";
+
+    return RPC_ERROR_INTERNAL_ERROR;
+}
+
+rpc_error_t
+rpc_sum_array_typed(const rpc_sum_array_args_t *args, rpc_sum_array_result_t *result, const char **error_msg,
+                    void *user_ptr) {
+    int64_t sum = 0;
+
+    CborValue iterator;
+    if (cbor_value_enter_container(&args->values, &iterator) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+    while (!cbor_value_at_end(&iterator)) {
+        if (cbor_value_is_integer(&iterator)) {
+            int64_t int_result;
+            cbor_value_get_int64(&iterator, &int_result);
+            sum += int_result;
+        } else {
+            *error_msg = "integers only";
+            return RPC_ERROR_INVALID_ARGS;
+        }
+
+        if (cbor_value_advance(&iterator) != CborNoError) return RPC_ERROR_PARSER_FAILED;
+    }
+
+    result->value = sum;
+    return RPC_OK;
+}
+
+rpc_error_t
+alt_add_typed(const alt_add_args_t *args, alt_add_result_t *result, const char **error_msg, void *user_ptr) {
+    result->value = args->a + args->b;
+    return RPC_OK;
+}